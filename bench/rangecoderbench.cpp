@@ -0,0 +1,261 @@
+#include "../rangecoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Throughput and compression ratio benchmark.
+// Prints one CSV row per case, so results can be diffed between releases.
+//
+//   usage: rangecoderbench [max_symbols] [repeat]
+//
+// MB/s is measured against input of ceil(log2(alphabet) / 8) bytes per symbol.
+// Time is the best of repeat runs.
+
+struct Result
+{
+    double encode_seconds;
+    double decode_seconds;
+    size_t num_bytes;
+    bool ok;
+};
+
+template<class Function>
+auto best_seconds(const int repeat, const Function &f) -> double
+{
+    auto best = std::numeric_limits<double>::max();
+    for (auto i = 0; i < repeat; i++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+auto entropy_bits_per_symbol(const std::vector<int> &data, const int alphabet) -> double
+{
+    auto count = std::vector<double>(alphabet, 0);
+    for (const auto d : data)
+    {
+        count[d] += 1;
+    }
+    auto entropy = 0.0;
+    for (const auto c : count)
+    {
+        if (c != 0)
+        {
+            const auto p = c / data.size();
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy;
+}
+
+// Static model, coded with batch API.
+template<class Encoder, class Decoder, class PModelT>
+auto bench_static(const PModelT &pmodel, const std::vector<int> &data, const int repeat) -> Result
+{
+    auto bytes = std::vector<rangecoder::byte_t>();
+    const auto encode_seconds = best_seconds(repeat, [&]() {
+        auto encoder = Encoder();
+        encoder.encode(pmodel, data.data(), data.data() + data.size());
+        bytes = encoder.finish();
+    });
+    auto decoded = std::vector<int>(data.size());
+    const auto decode_seconds = best_seconds(repeat, [&]() {
+        auto decoder = Decoder();
+        decoder.start(bytes.data(), bytes.size());
+        decoder.decode_n(pmodel, decoded.data(), decoded.size());
+    });
+    return {encode_seconds, decode_seconds, bytes.size(), decoded == data};
+}
+
+// Static model encoded through BufferSink into preallocated bytes, so renormalized bytes can be stored a word at a time.
+template<class Encoder, class Decoder, class PModelT>
+auto bench_static_buffer(const PModelT &pmodel, const std::vector<int> &data, const int repeat) -> Result
+{
+    // 16 bits per symbol is more than any symbol of models benched here costs.
+    auto bytes = std::vector<rangecoder::byte_t>(2 * data.size() + 16);
+    auto num_bytes = size_t(0);
+    const auto encode_seconds = best_seconds(repeat, [&]() {
+        auto encoder = Encoder(rangecoder::BufferSink(bytes.data(), bytes.size()));
+        encoder.encode(pmodel, data.data(), data.data() + data.size());
+        num_bytes = encoder.finish();
+    });
+    auto decoded = std::vector<int>(data.size());
+    const auto decode_seconds = best_seconds(repeat, [&]() {
+        auto decoder = Decoder();
+        decoder.start(bytes.data(), std::min(num_bytes, bytes.size()));
+        decoder.decode_n(pmodel, decoded.data(), decoded.size());
+    });
+    return {encode_seconds, decode_seconds, num_bytes, num_bytes <= bytes.size() && decoded == data};
+}
+
+// Adaptive model, coded one symbol at a time followed by update.
+auto bench_adaptive(const int alphabet, const std::vector<int> &data, const int repeat) -> Result
+{
+    auto bytes = std::vector<rangecoder::byte_t>();
+    const auto encode_seconds = best_seconds(repeat, [&]() {
+        auto pmodel = rangecoder::AdaptiveDistribution(alphabet);
+        auto encoder = rangecoder::RangeEncoder();
+        for (const auto d : data)
+        {
+            encoder.encode(pmodel, d);
+            pmodel.update(d);
+        }
+        bytes = encoder.finish();
+    });
+    auto decoded = std::vector<int>(data.size());
+    const auto decode_seconds = best_seconds(repeat, [&]() {
+        auto pmodel = rangecoder::AdaptiveDistribution(alphabet);
+        auto decoder = rangecoder::RangeDecoder();
+        decoder.start(bytes.data(), bytes.size());
+        for (auto &d : decoded)
+        {
+            d = decoder.decode(pmodel);
+            pmodel.update(d);
+        }
+    });
+    return {encode_seconds, decode_seconds, bytes.size(), decoded == data};
+}
+
+// Bytes coded as adaptive binary decisions.
+auto bench_bit_tree(const std::vector<int> &data, const int repeat) -> Result
+{
+    auto bytes = std::vector<rangecoder::byte_t>();
+    const auto encode_seconds = best_seconds(repeat, [&]() {
+        auto bit_tree = rangecoder::BitTreeModel<8>();
+        auto encoder = rangecoder::RangeEncoder();
+        for (const auto d : data)
+        {
+            encoder.encode_bit_tree(bit_tree, d);
+        }
+        bytes = encoder.finish();
+    });
+    auto decoded = std::vector<int>(data.size());
+    const auto decode_seconds = best_seconds(repeat, [&]() {
+        auto bit_tree = rangecoder::BitTreeModel<8>();
+        auto decoder = rangecoder::RangeDecoder();
+        decoder.start(bytes.data(), bytes.size());
+        for (auto &d : decoded)
+        {
+            d = decoder.decode_bit_tree(bit_tree);
+        }
+    });
+    return {encode_seconds, decode_seconds, bytes.size(), decoded == data};
+}
+
+// Uniform symbols coded as num_bits raw bits, without model.
+auto bench_raw_bits(const int num_bits, const std::vector<int> &data, const int repeat) -> Result
+{
+    auto bytes = std::vector<rangecoder::byte_t>();
+    const auto encode_seconds = best_seconds(repeat, [&]() {
+        auto encoder = rangecoder::RangeEncoder();
+        for (const auto d : data)
+        {
+            encoder.encode_bits(static_cast<uint64_t>(d), num_bits);
+        }
+        bytes = encoder.finish();
+    });
+    auto decoded = std::vector<int>(data.size());
+    const auto decode_seconds = best_seconds(repeat, [&]() {
+        auto decoder = rangecoder::RangeDecoder();
+        decoder.start(bytes.data(), bytes.size());
+        for (auto &d : decoded)
+        {
+            d = static_cast<int>(decoder.decode_bits(num_bits));
+        }
+    });
+    return {encode_seconds, decode_seconds, bytes.size(), decoded == data};
+}
+
+void print_header()
+{
+    std::cout << "case,model,alphabet,symbols,"
+              << "encode_mb_s,encode_ns_per_symbol,decode_mb_s,decode_ns_per_symbol,"
+              << "bits_per_symbol,entropy_bits_per_symbol,ok" << std::endl;
+}
+
+void print_row(const std::string &name, const std::string &model, const int alphabet, const std::vector<int> &data, const Result &result)
+{
+    auto bytes_per_symbol = 1;
+    while ((1 << (8 * bytes_per_symbol)) < alphabet && bytes_per_symbol < 3)
+    {
+        bytes_per_symbol++;
+    }
+    const auto n = static_cast<double>(data.size());
+    const auto input_mb = n * bytes_per_symbol / 1e6;
+    std::cout << name << ',' << model << ',' << alphabet << ',' << data.size() << ','
+              << input_mb / result.encode_seconds << ',' << result.encode_seconds * 1e9 / n << ','
+              << input_mb / result.decode_seconds << ',' << result.decode_seconds * 1e9 / n << ','
+              << result.num_bytes * 8 / n << ',' << entropy_bits_per_symbol(data, alphabet) << ','
+              << (result.ok ? "true" : "false") << std::endl;
+}
+
+template<int N>
+void bench_uniform(const size_t n, const int repeat)
+{
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> rand_index(0, N - 1);
+    auto data = std::vector<int>(n);
+    for (auto &d : data)
+    {
+        d = rand_index(rng);
+    }
+    const auto pmodel = rangecoder::UniformDistribution<N>();
+    print_row("carryless", "uniform", N, data, bench_static<rangecoder::RangeEncoder, rangecoder::RangeDecoder>(pmodel, data, repeat));
+    print_row("raw_bits", "uniform", N, data, bench_raw_bits(rangecoder::UniformDistribution<N>::TOTAL_FREQ_BITS, data, repeat));
+}
+
+void bench_skewed(const double p, const size_t n, const int repeat)
+{
+    const auto alphabet = 256;
+    std::mt19937 rng(12345);
+    std::geometric_distribution<int> rand_index(p);
+    auto data = std::vector<int>(n);
+    auto freq = std::vector<rangecoder::range_t>(alphabet, 0);
+    for (auto &d : data)
+    {
+        d = std::min(rand_index(rng), alphabet - 1);
+        freq[d]++;
+    }
+    const auto model = "skewed" + std::to_string(p).substr(0, 4);
+
+    const auto table = rangecoder::FrequencyTable(freq);
+    const auto lookup = rangecoder::LookupTableModel<rangecoder::FrequencyTable>(table);
+    const auto normalized = rangecoder::LookupTableModel<rangecoder::PowerOfTwoFrequencyTable<15>>(rangecoder::PowerOfTwoFrequencyTable<15>(freq));
+    print_row("carryless", model, alphabet, data, bench_static<rangecoder::RangeEncoder, rangecoder::RangeDecoder>(table, data, repeat));
+    print_row("carryless_lookup", model, alphabet, data, bench_static<rangecoder::RangeEncoder, rangecoder::RangeDecoder>(lookup, data, repeat));
+    print_row("carryless_pow2_lookup", model, alphabet, data, bench_static<rangecoder::RangeEncoder, rangecoder::RangeDecoder>(normalized, data, repeat));
+    print_row("carryless_pow2_lookup_branchless", model, alphabet, data,
+              bench_static_buffer<rangecoder::BasicRangeEncoder<rangecoder::BufferSink, rangecoder::NoStatistics, uint64_t, 8, true>,
+                                  rangecoder::BasicRangeDecoder<rangecoder::NoStatistics, uint64_t, 8, true>>(normalized, data, repeat));
+    print_row("carry", model, alphabet, data, bench_static<rangecoder::CarryRangeEncoder, rangecoder::CarryRangeDecoder>(table, data, repeat));
+    print_row("interleaved4", model, alphabet, data, bench_static<rangecoder::InterleavedRangeEncoder<4>, rangecoder::InterleavedRangeDecoder<4>>(lookup, data, repeat));
+    print_row("adaptive", model, alphabet, data, bench_adaptive(alphabet, data, repeat));
+    print_row("bit_tree", model, alphabet, data, bench_bit_tree(data, repeat));
+}
+
+int main(int argc, char **argv)
+{
+    const auto max_symbols = argc > 1 ? std::stoul(argv[1]) : 1ul << 20;
+    const auto repeat = argc > 2 ? std::stoi(argv[2]) : 3;
+
+    print_header();
+    for (size_t n = 1 << 10; n <= max_symbols; n *= 32)
+    {
+        bench_uniform<2>(n, repeat);
+        bench_uniform<16>(n, repeat);
+        bench_uniform<256>(n, repeat);
+        bench_uniform<65536>(n, repeat);
+        bench_skewed(0.5, n, repeat);
+        bench_skewed(0.05, n, repeat);
+    }
+    return 0;
+}
@@ -0,0 +1,455 @@
+#include "../rangecoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RANGECODER_CLI_MMAP 1
+#endif
+
+// File compressor built on rangecoder.h.
+//
+//   usage: rangecoder c|d [-m order0|order1|bittree] [-t threads] [-b block_size] [-q] input output
+//
+// Input is split into blocks coded independently on threads, each with fresh adaptive model.
+// Output is 1 byte model id followed by frame of FrameWriter, whose block index and checksums
+// let d check and decode blocks in parallel.
+
+// Models' probabilities stay below 1 (order-0 and order-1 totals are capped at 2^16, bit models at 4065/4096),
+// so a symbol costs at least 1/1500 byte. Blocks claiming more symbols per byte of stream are corrupt.
+constexpr size_t MAX_SYMBOLS_PER_BYTE = 4096;
+
+enum class Model : rangecoder::byte_t {
+    ORDER0 = 0,
+    ORDER1 = 1,
+    BIT_TREE = 2,
+};
+
+struct Options
+{
+    bool compress = true;
+    Model model = Model::ORDER1;
+    unsigned num_threads = 0;
+    size_t block_size = size_t(1) << 20;
+    bool quiet = false;
+    std::string input;
+    std::string output;
+};
+
+// Read only view of whole file, memory mapped where available.
+class InputFile
+{
+public:
+    InputFile() = default;
+    InputFile(const InputFile &) = delete;
+    InputFile &operator=(const InputFile &) = delete;
+
+    ~InputFile()
+    {
+#ifdef RANGECODER_CLI_MMAP
+        if (m_mapped != nullptr)
+        {
+            munmap(m_mapped, m_size);
+        }
+#endif
+    }
+
+    auto open(const std::string &path) -> bool
+    {
+#ifdef RANGECODER_CLI_MMAP
+        const auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        m_size = static_cast<size_t>(st.st_size);
+        if (m_size != 0)
+        {
+            m_mapped = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m_mapped == MAP_FAILED)
+            {
+                m_mapped = nullptr;
+                close(fd);
+                return false;
+            }
+            madvise(m_mapped, m_size, MADV_SEQUENTIAL);
+        }
+        close(fd);
+        m_data = static_cast<const rangecoder::byte_t *>(m_mapped);
+        return true;
+#else
+        auto is = std::ifstream(path, std::ios::binary);
+        if (!is)
+        {
+            return false;
+        }
+        m_buffer.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+        m_size = m_buffer.size();
+        m_data = m_buffer.data();
+        return true;
+#endif
+    }
+
+    auto data() const -> const rangecoder::byte_t *
+    {
+        return m_data;
+    }
+
+    auto size() const -> size_t
+    {
+        return m_size;
+    }
+
+private:
+    const rangecoder::byte_t *m_data = nullptr;
+    size_t m_size = 0;
+#ifdef RANGECODER_CLI_MMAP
+    void *m_mapped = nullptr;
+#else
+    std::vector<rangecoder::byte_t> m_buffer;
+#endif
+};
+
+// Prints progress to stderr as blocks complete, from any thread.
+class Progress
+{
+public:
+    Progress(const char *action, const size_t total, const bool quiet) : m_action(action), m_total(total), m_quiet(quiet)
+    {
+    }
+
+    void add(const size_t num_bytes)
+    {
+        if (m_quiet || m_total == 0)
+        {
+            return;
+        }
+        const auto lock = std::lock_guard<std::mutex>(m_mutex);
+        m_done += num_bytes;
+        const auto percent = 100 * m_done / m_total;
+        if (percent != m_percent)
+        {
+            m_percent = percent;
+            std::cerr << '\r' << m_action << ' ' << percent << '%' << std::flush;
+        }
+    }
+
+    void finish()
+    {
+        if (!m_quiet && m_total != 0)
+        {
+            std::cerr << '\r' << std::string(std::char_traits<char>::length(m_action) + 5, ' ') << '\r';
+        }
+    }
+
+private:
+    const char *m_action;
+    size_t m_total;
+    bool m_quiet;
+    size_t m_done = 0;
+    size_t m_percent = 0;
+    std::mutex m_mutex;
+};
+
+auto encode_block(const Model model, const rangecoder::byte_t *first, const rangecoder::byte_t *last) -> std::vector<rangecoder::byte_t>
+{
+    auto encoder = rangecoder::RangeEncoder();
+    switch (model)
+    {
+        case Model::ORDER0:
+        {
+            auto pmodel = rangecoder::AdaptiveDistribution(256);
+            for (auto it = first; it != last; ++it)
+            {
+                encoder.encode(pmodel, *it);
+                pmodel.update(*it);
+            }
+            break;
+        }
+        case Model::ORDER1:
+        {
+            auto pmodel = rangecoder::ContextModel(256, 1, 8);
+            for (auto it = first; it != last; ++it)
+            {
+                encoder.encode(pmodel, *it);
+                pmodel.update(*it);
+            }
+            break;
+        }
+        case Model::BIT_TREE:
+        {
+            auto bit_tree = rangecoder::BitTreeModel<8>();
+            for (auto it = first; it != last; ++it)
+            {
+                encoder.encode_bit_tree(bit_tree, *it);
+            }
+            break;
+        }
+    }
+    return encoder.finish();
+}
+
+void decode_block(const Model model, const rangecoder::byte_t *bytes, const size_t size, rangecoder::byte_t *out, const size_t n)
+{
+    auto decoder = rangecoder::RangeDecoder();
+    decoder.start(bytes, size);
+    switch (model)
+    {
+        case Model::ORDER0:
+        {
+            auto pmodel = rangecoder::AdaptiveDistribution(256);
+            for (size_t i = 0; i < n; i++)
+            {
+                const auto index = decoder.decode(pmodel);
+                pmodel.update(index);
+                out[i] = static_cast<rangecoder::byte_t>(index);
+            }
+            break;
+        }
+        case Model::ORDER1:
+        {
+            auto pmodel = rangecoder::ContextModel(256, 1, 8);
+            for (size_t i = 0; i < n; i++)
+            {
+                const auto index = decoder.decode(pmodel);
+                pmodel.update(index);
+                out[i] = static_cast<rangecoder::byte_t>(index);
+            }
+            break;
+        }
+        case Model::BIT_TREE:
+        {
+            auto bit_tree = rangecoder::BitTreeModel<8>();
+            for (size_t i = 0; i < n; i++)
+            {
+                out[i] = static_cast<rangecoder::byte_t>(decoder.decode_bit_tree(bit_tree));
+            }
+            break;
+        }
+    }
+}
+
+auto write_file(const std::string &path, const rangecoder::byte_t *bytes, const size_t size) -> bool
+{
+    auto os = std::ofstream(path, std::ios::binary);
+    os.write(reinterpret_cast<const char *>(bytes), static_cast<std::streamsize>(size));
+    return static_cast<bool>(os);
+}
+
+auto compress(const Options &options, const InputFile &input) -> std::vector<rangecoder::byte_t>
+{
+    // Written so that block sizes near 2^64 neither wrap the count nor the end of last block.
+    const auto num_blocks = input.size() / options.block_size + (input.size() % options.block_size != 0 ? 1 : 0);
+    const auto block_length = [&](const size_t block) { return std::min(options.block_size, input.size() - block * options.block_size); };
+    auto blocks = std::vector<std::vector<rangecoder::byte_t>>(num_blocks);
+    auto progress = Progress("compress", input.size(), options.quiet);
+    rangecoder::parallel_for(num_blocks, options.num_threads, [&](const size_t block) {
+        const auto first = input.data() + block * options.block_size;
+        const auto last = first + block_length(block);
+        blocks[block] = encode_block(options.model, first, last);
+        progress.add(static_cast<size_t>(last - first));
+    });
+    progress.finish();
+
+    auto writer = rangecoder::FrameWriter();
+    for (size_t block = 0; block < num_blocks; block++)
+    {
+        writer.add_block(blocks[block], block_length(block));
+        blocks[block] = {};
+    }
+    auto frame = writer.finish();
+    frame.insert(frame.begin(), static_cast<rangecoder::byte_t>(options.model));
+    return frame;
+}
+
+// Returns false if input is not a valid compressed file.
+auto decompress(const Options &options, const InputFile &input, std::vector<rangecoder::byte_t> &output) -> bool
+{
+    if (input.size() == 0 || input.data()[0] > static_cast<rangecoder::byte_t>(Model::BIT_TREE))
+    {
+        return false;
+    }
+    const auto model = static_cast<Model>(input.data()[0]);
+    auto reader = rangecoder::FrameReader();
+    if (!reader.open(input.data() + 1, input.size() - 1))
+    {
+        return false;
+    }
+    for (size_t block = 0; block < reader.num_blocks(); block++)
+    {
+        if (!reader.verify_block(block) || reader.block_num_symbols(block) / MAX_SYMBOLS_PER_BYTE > reader.block_stream_size(block))
+        {
+            return false;
+        }
+    }
+
+    output.resize(reader.num_symbols());
+    auto progress = Progress("decompress", output.size(), options.quiet);
+    rangecoder::parallel_for(reader.num_blocks(), options.num_threads, [&](const size_t block) {
+        const auto n = reader.block_num_symbols(block);
+        decode_block(model, reader.block_stream(block), reader.block_stream_size(block), output.data() + reader.block_first_symbol(block), n);
+        progress.add(n);
+    });
+    progress.finish();
+    return true;
+}
+
+void print_usage()
+{
+    std::cerr << "usage: rangecoder c|d [-m order0|order1|bittree] [-t threads] [-b block_size] [-q] input output" << std::endl
+              << "  c, d  compress or decompress input into output" << std::endl
+              << "  -m    model to compress with (default order1), decompress reads it from input" << std::endl
+              << "  -t    number of threads (default 0, hardware concurrency)" << std::endl
+              << "  -b    block size in bytes (default 1048576)" << std::endl
+              << "  -q    print nothing but errors" << std::endl;
+}
+
+// Returns false on invalid arguments.
+auto parse_options(const int argc, char **argv, Options &options) -> bool
+{
+    if (argc < 2 || (std::strcmp(argv[1], "c") != 0 && std::strcmp(argv[1], "d") != 0))
+    {
+        return false;
+    }
+    options.compress = std::strcmp(argv[1], "c") == 0;
+    auto positional = std::vector<std::string>();
+    for (auto i = 2; i < argc; i++)
+    {
+        const auto arg = std::string(argv[i]);
+        const auto has_value = i + 1 < argc;
+        if (arg == "-q")
+        {
+            options.quiet = true;
+        }
+        else if (arg == "-m" && has_value)
+        {
+            const auto model = std::string(argv[++i]);
+            if (model == "order0")
+            {
+                options.model = Model::ORDER0;
+            }
+            else if (model == "order1")
+            {
+                options.model = Model::ORDER1;
+            }
+            else if (model == "bittree")
+            {
+                options.model = Model::BIT_TREE;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (arg == "-t" && has_value)
+        {
+            options.num_threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (arg == "-b" && has_value)
+        {
+            options.block_size = std::stoull(argv[++i]);
+            if (options.block_size == 0)
+            {
+                return false;
+            }
+        }
+        else if (!arg.empty() && arg[0] == '-')
+        {
+            return false;
+        }
+        else
+        {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 2)
+    {
+        return false;
+    }
+    options.input = positional[0];
+    options.output = positional[1];
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    auto options = Options();
+    try
+    {
+        if (!parse_options(argc, argv, options))
+        {
+            print_usage();
+            return 2;
+        }
+    }
+    catch (const std::exception &)
+    {
+        print_usage();
+        return 2;
+    }
+
+    auto input = InputFile();
+    if (!input.open(options.input))
+    {
+        std::cerr << "rangecoder: can not read " << options.input << std::endl;
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto output = std::vector<rangecoder::byte_t>();
+    try
+    {
+        if (options.compress)
+        {
+            output = compress(options, input);
+        }
+        else if (!decompress(options, input, output))
+        {
+            std::cerr << "rangecoder: " << options.input << " is not a valid compressed file" << std::endl;
+            return 1;
+        }
+    }
+    catch (const std::bad_alloc &)
+    {
+        std::cerr << "rangecoder: out of memory for " << options.input << std::endl;
+        return 1;
+    }
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!write_file(options.output, output.data(), output.size()))
+    {
+        std::cerr << "rangecoder: can not write " << options.output << std::endl;
+        return 1;
+    }
+
+    if (!options.quiet)
+    {
+        const auto raw_size = options.compress ? input.size() : output.size();
+        const auto compressed_size = options.compress ? output.size() : input.size();
+        std::cerr << (options.compress ? "compressed " : "decompressed ") << input.size() << " -> " << output.size() << " bytes";
+        if (raw_size != 0)
+        {
+            std::cerr << ", " << 8.0 * static_cast<double>(compressed_size) / static_cast<double>(raw_size) << " bits/byte";
+        }
+        std::cerr << ", " << seconds << " s, " << static_cast<double>(raw_size) / 1e6 / std::max(seconds, 1e-9) << " MB/s" << std::endl;
+    }
+    return 0;
+}
@@ -2,14 +2,21 @@
 #ifndef RANGECODER_H_
 #define RANGECODER_H_
 
-#include <functional>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <limits>
 #include <queue>
 #include <sstream>
+#include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace rangecoder
@@ -28,7 +35,8 @@ namespace rangecoder
 
         range_t total_freq() const
         {
-            return cum_freq(max_index()) + c_freq(max_index());
+            const auto last = max_index();
+            return cum_freq(last) + c_freq(last);
         };
 
         // Returns min index, the first valid index.
@@ -50,6 +58,91 @@ namespace rangecoder
         VERBOSE = true,
     };
 
+    // Statistics policy of coder, which records nothing and costs nothing.
+    class NoStatistics
+    {
+    public:
+        void on_symbol() {}
+        void on_no_carry_expansion() {}
+        template<class State>
+        void on_range_reduction_expansion(const State, const State) {}
+        void on_renormalization(const int) {}
+    };
+
+    // Statistics policy of coder, which counts coder events with a few increments per symbol.
+    // Use as BasicRangeEncoder<ByteSink, CodingStatistics> or BasicRangeDecoder<CodingStatistics>,
+    // and read by statistics().
+    class CodingStatistics
+    {
+    public:
+        // Renormalizations shifting more bytes than this are counted as this.
+        static constexpr int MAX_RENORMALIZATION_BYTES = 15;
+
+        void on_symbol()
+        {
+            m_num_symbols++;
+        }
+
+        void on_no_carry_expansion()
+        {
+            m_num_no_carry_expansions++;
+        }
+
+        template<class State>
+        void on_range_reduction_expansion(const State range_before, const State range_after)
+        {
+            m_num_range_reduction_expansions++;
+            // Range reduction is rare, so log2 is affordable here.
+            m_range_reduction_bits_lost += std::log2(static_cast<double>(range_before)) - std::log2(static_cast<double>(std::max(range_after, State(1))));
+        }
+
+        void on_renormalization(const int num_bytes)
+        {
+            m_renormalization_histogram[std::min(num_bytes, MAX_RENORMALIZATION_BYTES)]++;
+        }
+
+        // Number of symbols coded, including each binary decision.
+        auto num_symbols() const -> uint64_t
+        {
+            return m_num_symbols;
+        }
+
+        // Number of bytes (units, for coders with wider units) shifted by expansions, i.e. all but those flushed by finish().
+        auto num_bytes() const -> uint64_t
+        {
+            return m_num_no_carry_expansions + m_num_range_reduction_expansions;
+        }
+
+        auto num_no_carry_expansions() const -> uint64_t
+        {
+            return m_num_no_carry_expansions;
+        }
+
+        auto num_range_reduction_expansions() const -> uint64_t
+        {
+            return m_num_range_reduction_expansions;
+        }
+
+        // Coding space thrown away by range reduction expansions, in bits.
+        auto range_reduction_bits_lost() const -> double
+        {
+            return m_range_reduction_bits_lost;
+        }
+
+        // Number of symbols that shifted num_bytes bytes.
+        auto renormalization_histogram(const int num_bytes) const -> uint64_t
+        {
+            return m_renormalization_histogram[std::min(num_bytes, MAX_RENORMALIZATION_BYTES)];
+        }
+
+    private:
+        uint64_t m_num_symbols = 0;
+        uint64_t m_num_no_carry_expansions = 0;
+        uint64_t m_num_range_reduction_expansions = 0;
+        double m_range_reduction_bits_lost = 0;
+        std::array<uint64_t, MAX_RENORMALIZATION_BYTES + 1> m_renormalization_histogram = {};
+    };
+
     namespace local
     {
         constexpr auto TOP8 = range_t(1) << (64 - 8);
@@ -69,28 +162,193 @@ namespace rangecoder
             return sformatter.str();
         }
 
-        class RangeCoder
+        // Other unsigned widths, including unsigned __int128 which ostream can not print.
+        template<class T>
+        auto hex_zero_filled(const T value) -> std::string
+        {
+            auto s = std::string();
+            for (auto i = static_cast<int>(sizeof(T)) - 1; i >= 0; i--)
+            {
+                s += hex_zero_filled(static_cast<byte_t>(value >> (8 * i)));
+            }
+            return s;
+        }
+
+        template<class PModelT, class = void>
+        struct has_total_freq : std::false_type
+        {
+        };
+
+        template<class PModelT>
+        struct has_total_freq<PModelT, std::void_t<decltype(std::declval<const PModelT &>().total_freq())>> : std::true_type
+        {
+        };
+
+        // Total frequency of pmodel.
+        // Models may provide their own (non virtual) total_freq(), otherwise it is computed from max_index.
+        template<class PModelT>
+        auto total_freq(const PModelT &pmodel) -> range_t
+        {
+            if constexpr (has_total_freq<PModelT>::value)
+            {
+                return pmodel.total_freq();
+            }
+            else
+            {
+                const auto last = pmodel.max_index();
+                return pmodel.cum_freq(last) + pmodel.c_freq(last);
+            }
+        }
+
+        template<class PModelT, class = void>
+        struct total_freq_bits : std::integral_constant<int, -1>
+        {
+        };
+
+        // Models whose total_freq() is always 2^k declare `static constexpr int TOTAL_FREQ_BITS = k;`
+        // (negative value means not power of two).
+        template<class PModelT>
+        struct total_freq_bits<PModelT, std::void_t<decltype(PModelT::TOTAL_FREQ_BITS)>> : std::integral_constant<int, PModelT::TOTAL_FREQ_BITS>
+        {
+        };
+
+        // range / total_freq, or shift if PModelT declares TOTAL_FREQ_BITS.
+        template<class PModelT, class State>
+        auto range_per_total(const State range, const range_t total_freq) -> State
+        {
+            if constexpr (total_freq_bits<PModelT>::value >= 0)
+            {
+                return range >> total_freq_bits<PModelT>::value;
+            }
+            else
+            {
+                return range / total_freq;
+            }
+        }
+
+        constexpr auto log2_if_power_of_two(const range_t n) -> int
+        {
+            if (n == 0 || (n & (n - 1)) != 0)
+            {
+                return -1;
+            }
+            auto bits = 0;
+            while ((range_t(1) << bits) != n)
+            {
+                bits++;
+            }
+            return bits;
+        }
+
+        template<class PModelT, class = void>
+        struct has_find_index : std::false_type
+        {
+        };
+
+        // Models that can find index faster than binary search over cum_freq provide `int find_index(range_t f) const`.
+        template<class PModelT>
+        struct has_find_index<PModelT, std::void_t<decltype(std::declval<const PModelT &>().find_index(range_t()))>> : std::true_type
+        {
+        };
+
+        // Find index whose range [cum_freq(index), cum_freq(index + 1)) contains f, in [left, right].
+        template<class PModelT>
+        auto find_index(const PModelT &pmodel, const range_t f, int left, int right) -> int
+        {
+            if constexpr (has_find_index<PModelT>::value)
+            {
+                return pmodel.find_index(f);
+            }
+            while (left < right)
+            {
+                const auto mid = left + (right - left) / 2;
+                if (pmodel.cum_freq(mid + 1) <= f)
+                {
+                    left = mid + 1;
+                }
+                else
+                {
+                    right = mid;
+                }
+            }
+            return left;
+        }
+
+        // Number of leading zero bits of x, all bits if x is 0.
+        template<class T>
+        auto count_leading_zeros(const T x) -> int
+        {
+            constexpr auto BITS = static_cast<int>(sizeof(T)) * 8;
+            if constexpr (BITS > 64)
+            {
+                const auto high = static_cast<uint64_t>(x >> 64);
+                return high != 0 ? count_leading_zeros(high) : 64 + count_leading_zeros(static_cast<uint64_t>(x));
+            }
+            else
+            {
+#if defined(__GNUC__)
+                return x == 0 ? BITS : __builtin_clzll(static_cast<unsigned long long>(x)) - (64 - BITS);
+#else
+                auto n = 0;
+                while (n < BITS && ((x >> (BITS - 1 - n)) & 1) == 0)
+                {
+                    n++;
+                }
+                return n;
+#endif
+            }
+        }
+
+        template<int UNIT_BITS>
+        struct unit_type
+        {
+            static_assert(UNIT_BITS == 8 || UNIT_BITS == 16 || UNIT_BITS == 32, "UNIT_BITS must be 8, 16 or 32");
+            using type = std::conditional_t<UNIT_BITS == 8, uint8_t, std::conditional_t<UNIT_BITS == 16, uint16_t, uint32_t>>;
+        };
+
+        // Coder core with State wide lower bound and range (uint32_t, uint64_t or unsigned __int128),
+        // shifting out UNIT_BITS (8, 16 or 32) bits at a time.
+        // Range is kept at least BOTTOM = 2^(state bits - 2 * UNIT_BITS), so total_freq of models must not exceed it.
+        // With BRANCHLESS, renormalization counts units to shift from leading zeros instead of testing unit by unit,
+        // which gives same stream. It pays off only where the renormalization branches mispredict more than
+        // the longer dependency chain through the variable shift costs, so it is off by default.
+        // Statistics is inherited, so NoStatistics takes no space.
+        template<class Statistics = NoStatistics, class State = range_t, int UNIT_BITS = 8, bool BRANCHLESS = false>
+        class RangeCoder : Statistics
         {
         public:
+            using state_t = State;
+            using unit_t = typename unit_type<UNIT_BITS>::type;
+
+            // Statistics reports each expansion, so it always renormalizes unit by unit.
+            static constexpr bool BRANCHLESS_RENORMALIZATION = BRANCHLESS && std::is_same<Statistics, NoStatistics>::value;
+
+            static constexpr int STATE_BITS = static_cast<int>(sizeof(State)) * 8;
+            static constexpr int UNIT_BYTES = UNIT_BITS / 8;
+            static constexpr int UNITS_PER_STATE = STATE_BITS / UNIT_BITS;
+            static constexpr auto TOP = State(1) << (STATE_BITS - UNIT_BITS);
+            static constexpr auto BOTTOM = State(1) << (STATE_BITS - 2 * UNIT_BITS);
+            static_assert(STATE_BITS - 2 * UNIT_BITS >= 16, "State must be at least 2 * UNIT_BITS + 16 bits");
+            // Number of raw bits coded per range split by encode_bits, so range stays above 2^BYPASS_BITS.
+            static constexpr int BYPASS_BITS = std::min(16, (STATE_BITS - 2 * UNIT_BITS) / 2);
+
             RangeCoder()
             {
                 m_lower_bound = 0;
-                m_range = std::numeric_limits<range_t>::max();
+                m_range = ~State(0);
             };
 
-            template<RangeCoderVerbose RANGECODER_VERBOSE>
+            // Narrow range to [cum_freq, cum_freq + c_freq) scaled by range_per_total, i.e. range / total_freq.
+            // Model lookups are left to the caller, so they are resolved against the static model type.
+            // f(bits, num_units) is called for units shifted out, which are top num_units units of bits.
+            // It is called for each unit, or once per symbol with BRANCHLESS_RENORMALIZATION.
+            template<RangeCoderVerbose RANGECODER_VERBOSE, class OutputFunction>
             auto update_param(
-                const PModel &pmodel, const int index, const std::function<void(byte_t)> &f = [](byte_t) {}) -> int
+                const State range_per_total, const range_t c_freq, const range_t cum_freq, OutputFunction &&f) -> int
             {
-                const auto c_freq = pmodel.c_freq(index);
-                const auto cum_freq = pmodel.cum_freq(index);
-                const auto total_freq = pmodel.total_freq();
-
-                auto num_bytes = 0;
-
-                const auto range_per_total = m_range / total_freq;
                 m_range = range_per_total * c_freq;
                 m_lower_bound += range_per_total * cum_freq;
+                Statistics::on_symbol();
 
                 if constexpr (RANGECODER_VERBOSE)
                 {
@@ -98,32 +356,58 @@ namespace rangecoder
                     print_status();
                 }
 
-                while (is_no_carry_expansion_needed())
+                if constexpr (BRANCHLESS_RENORMALIZATION && !RANGECODER_VERBOSE)
                 {
-                    f(do_no_carry_expansion<RANGECODER_VERBOSE>());
-                    num_bytes++;
+                    const auto bits = m_lower_bound;
+                    const auto num_units = renormalize();
+                    f(bits, num_units);
+                    return num_units;
                 }
-                while (is_range_reduction_expansion_needed())
+                else
                 {
-                    f(do_range_reduction_expansion<RANGECODER_VERBOSE>());
-                    num_bytes++;
+                    auto num_units = 0;
+                    while (is_no_carry_expansion_needed())
+                    {
+                        const auto bits = m_lower_bound;
+                        do_no_carry_expansion<RANGECODER_VERBOSE>();
+                        f(bits, 1);
+                        num_units++;
+                    }
+                    while (is_range_reduction_expansion_needed())
+                    {
+                        const auto bits = m_lower_bound;
+                        do_range_reduction_expansion<RANGECODER_VERBOSE>();
+                        f(bits, 1);
+                        num_units++;
+                    }
+                    Statistics::on_renormalization(num_units);
+                    if constexpr (RANGECODER_VERBOSE)
+                    {
+                        std::cout << "  total: " << num_units << " unit shifted" << std::endl;
+                    }
+                    return num_units;
                 }
-                if constexpr (RANGECODER_VERBOSE)
+            };
+
+            // Call put(byte) for each byte of top num_units units of bits, from most significant.
+            template<class PutByte>
+            static void for_each_byte(const State bits, const int num_units, PutByte &&put)
+            {
+                for (auto i = 0; i < num_units * UNIT_BYTES; i++)
                 {
-                    std::cout << "  total: " << num_bytes << " byte shifted" << std::endl;
+                    put(static_cast<byte_t>(bits >> (STATE_BITS - 8 - 8 * i)));
                 }
-                return num_bytes;
-            };
+            }
 
             template<RangeCoderVerbose RANGECODER_VERBOSE>
-            auto shift_byte() -> byte_t
+            auto shift_unit() -> unit_t
             {
-                auto tmp = static_cast<byte_t>(m_lower_bound >> (64 - 8));
-                m_range <<= 8;
-                m_lower_bound <<= 8;
+                auto tmp = static_cast<unit_t>(m_lower_bound >> (STATE_BITS - UNIT_BITS));
+                m_range <<= UNIT_BITS;
+                m_lower_bound <<= UNIT_BITS;
                 if constexpr (RANGECODER_VERBOSE)
                 {
-                    std::cout << "  shifted out byte: "
+                    std::cout << "  shifted out unit: "
                               << "0x"
                               << local::hex_zero_filled(tmp)
                               << std::endl;
@@ -138,320 +422,2574 @@ namespace rangecoder
                 std::cout << "  upper bound: 0x" << local::hex_zero_filled(upper_bound()) << std::endl;
             }
 
-        protected:
-            void lower_bound(const range_t lower_bound)
+            auto lower_bound() const -> State
             {
-                m_lower_bound = lower_bound;
+                return m_lower_bound;
             };
 
-            void range(const range_t range)
+            auto range() const -> State
             {
-                m_range = range;
+                return m_range;
             };
 
-            auto lower_bound() const -> range_t
+            auto upper_bound() const -> State
             {
-                return m_lower_bound;
+                return m_lower_bound + m_range;
             };
 
-            auto range() const -> range_t
+            auto statistics() const -> const Statistics &
             {
-                return m_range;
+                return *this;
+            }
+
+        protected:
+            void lower_bound(const State lower_bound)
+            {
+                m_lower_bound = lower_bound;
             };
 
-            auto upper_bound() const -> uint64_t
+            void range(const State range)
             {
-                return m_lower_bound + m_range;
+                m_range = range;
             };
 
         private:
+            // Shift out stable units, then units of range reduction, and returns number of units shifted,
+            // same as the two loops in update_param.
+            auto renormalize() -> int
+            {
+                // Units where lower and upper bound agree. Difference is never 0, | 1 only guards clz.
+                const auto num_stable = count_leading_zeros((m_lower_bound ^ upper_bound()) | 1) / UNIT_BITS;
+                m_lower_bound <<= UNIT_BITS * num_stable;
+                m_range <<= UNIT_BITS * num_stable;
+                if (m_range >= BOTTOM)
+                {
+                    return num_stable;
+                }
+                // Range reduction, which is rare, shifts one unit and one more for each following unit
+                // of ~lower_bound below BOTTOM which is 0, i.e. would give range below BOTTOM again.
+                // At most UNITS_PER_STATE - 1 units are shifted in all, so shifts stay below STATE_BITS.
+                const auto num_zero = (count_leading_zeros(~m_lower_bound & (BOTTOM - 1)) - 2 * UNIT_BITS) / UNIT_BITS;
+                m_range = (~(m_lower_bound << (UNIT_BITS * num_zero)) & (BOTTOM - 1)) << UNIT_BITS;
+                m_lower_bound <<= UNIT_BITS * (1 + num_zero);
+                return num_stable + 1 + num_zero;
+            }
+
             auto is_no_carry_expansion_needed() const -> bool
             {
-                return (m_lower_bound ^ upper_bound()) < local::TOP8;
+                return (m_lower_bound ^ upper_bound()) < TOP;
             };
 
             template<RangeCoderVerbose RANGECODER_VERBOSE>
-            auto do_no_carry_expansion() -> byte_t
+            void do_no_carry_expansion()
             {
                 if constexpr (RANGECODER_VERBOSE)
                 {
                     std::cout << "  no carry expansion" << std::endl;
                 }
-                return shift_byte<RANGECODER_VERBOSE>();
+                Statistics::on_no_carry_expansion();
+                shift_unit<RANGECODER_VERBOSE>();
             };
 
             auto is_range_reduction_expansion_needed() const -> bool
             {
-                return m_range < local::TOP16;
+                return m_range < BOTTOM;
             };
 
             template<RangeCoderVerbose RANGECODER_VERBOSE>
-            auto do_range_reduction_expansion() -> byte_t
+            void do_range_reduction_expansion()
             {
                 if constexpr (RANGECODER_VERBOSE)
                 {
                     std::cout << "  range reduction expansion" << std::endl;
                 }
-                m_range = (~m_lower_bound) & (local::TOP16 - 1);
-                return shift_byte<RANGECODER_VERBOSE>();
+                const auto range_before = m_range;
+                m_range = (~m_lower_bound) & (BOTTOM - 1);
+                Statistics::on_range_reduction_expansion(range_before, m_range);
+                shift_unit<RANGECODER_VERBOSE>();
             };
 
-            uint64_t m_lower_bound;
-            uint64_t m_range;
+            State m_lower_bound;
+            State m_range;
         };
     }// namespace local
 
-    class RangeEncoder : local::RangeCoder
+    // Adaptive probability of a binary decision, coded with RangeEncoder::encode_bit.
+    // Probability is PROB_BITS fixed point, so coder narrows range with shift and multiply, never divide.
+    class BitModel
     {
     public:
-        // Returns number of bytes stabled.
-        template<RangeCoderVerbose RANGECODER_VERBOSE = SILENT>
-        auto encode(const PModel &pmodel, const int index) -> int
-        {
-            if constexpr (RANGECODER_VERBOSE)
-            {
-                std::cout << "  encode: " << index << std::endl;
-                print_status();
-            }
-            const auto n = update_param<RANGECODER_VERBOSE>(pmodel, index, [this](auto byte) { m_bytes.push_back(byte); });
-            if constexpr (RANGECODER_VERBOSE)
-            {
-                std::cout << "  encode: " << index << " done" << std::endl
-                          << std::endl;
-            }
-            return n;
-        };
-
-        template<RangeCoderVerbose RANGECODER_VERBOSE = SILENT>
-        auto finish() -> std::vector<byte_t>
-        {
-            for (auto i = 0; i < 8; i++)
-            {
-                m_bytes.push_back(shift_byte<RANGECODER_VERBOSE>());
-            }
-            return m_bytes;
-        }
+        static constexpr int PROB_BITS = 12;
+        static constexpr int ADAPT_SHIFT = 5;
 
-        friend std::ostream &operator<<(std::ostream &os, RangeEncoder &re)
+        // Probability of bit 0, in [1, 2^PROB_BITS).
+        auto probability() const -> range_t
         {
-            const auto data = re.finish();
-            // write all bytes in data to ostream
-            for (const auto byte : data)
-            {
-                os << byte;
-            }
-            return os;
+            return m_prob;
         }
 
-        void print_status() const
+        void update(const int bit)
         {
-            std::cout << "        range: 0x" << local::hex_zero_filled(range()) << std::endl;
-            std::cout << "  lower bound: 0x" << local::hex_zero_filled(lower_bound()) << std::endl;
-            std::cout << "  upper bound: 0x" << local::hex_zero_filled(upper_bound()) << std::endl;
-            if (m_bytes.empty())
+            if (bit)
             {
-                std::cout << "        bytes: NULL" << std::endl;
+                m_prob -= m_prob >> ADAPT_SHIFT;
             }
             else
             {
-                std::cout << "        bytes: 0x";
-                for (const auto byte : m_bytes)
-                {
-                    std::cout << local::hex_zero_filled(byte);
-                }
-                std::cout << std::endl;
+                m_prob += ((1u << PROB_BITS) - m_prob) >> ADAPT_SHIFT;
             }
         }
 
     private:
-        std::vector<uint8_t> m_bytes;
+        uint16_t m_prob = 1u << (PROB_BITS - 1);
     };
 
-    class RangeDecoder : local::RangeCoder
+    // Codes NUM_BITS bit symbols as NUM_BITS binary decisions, from most significant bit,
+    // each with BitModel selected by bits already coded.
+    template<int NUM_BITS = 8>
+    class BitTreeModel
     {
     public:
-        void start(std::istream &is)
+        static constexpr int MAX_SYMBOL = (1 << NUM_BITS) - 1;
+
+        // node is 1 followed by bits already coded, in [1, 2^NUM_BITS).
+        auto bit_model(const int node) -> BitModel &
         {
-            std::queue<byte_t> empty;
-            m_bytes.swap(empty);
+            return m_bit_models[node];
+        }
 
-            // read bytes from isteram into m_bytes
-            // until reach to eof
-            while (is.good())
-            {
-                m_bytes.push(is.get());
-            }
-            lower_bound(0);
-            range(std::numeric_limits<range_t>::max());
+    private:
+        BitModel m_bit_models[1 << NUM_BITS];
+    };
 
-            for (auto i = 0; i < 8; i++)
-            {
-                shift_byte_buffer();
-            }
-        }
+    // Byte sinks, where RangeEncoder writes encoded bytes.
+    // A sink provides put(byte_t), size() (number of bytes put so far) and finish(),
+    // whose return value is returned from RangeEncoder::finish().
 
-        void start(std::queue<byte_t> bytes)
-        {
-            m_bytes = std::move(bytes);
-            lower_bound(0);
-            range(std::numeric_limits<range_t>::max());
+    // Owns a growing vector, finish() moves it out.
+    class VectorSink
+    {
+    public:
+        VectorSink() = default;
 
-            for (auto i = 0; i < 8; i++)
-            {
-                shift_byte_buffer();
-            }
-        };
+        explicit VectorSink(std::vector<byte_t> bytes) : m_bytes(std::move(bytes))
+        {
+            m_bytes.clear();
+        }
 
-        void start(const std::vector<byte_t> &bytes)
+        void put(const byte_t byte)
         {
-            // Convert vector to queue.
-            for (auto byte : bytes)
-            {
-                m_bytes.push(byte);
-            }
-            lower_bound(0);
-            range(std::numeric_limits<range_t>::max());
+            m_bytes.push_back(byte);
+        }
 
-            for (auto i = 0; i < 8; i++)
-            {
-                shift_byte_buffer();
-            }
-        };
+        auto size() const -> size_t
+        {
+            return m_bytes.size();
+        }
 
-        // Returns index of pmodel used to encode.
-        // pmodel **must** be same as used to encode.
-        template<RangeCoderVerbose RANGECODER_VERBOSE = SILENT>
-        auto decode(const PModel &pmodel) -> int
+        auto data() const -> const byte_t *
         {
-            if constexpr (RANGECODER_VERBOSE)
-            {
-                std::cout << "  decode: unknown " << std::endl;
-                print_status();
-            }
-            const auto index = binary_search_encoded_index<RANGECODER_VERBOSE>(pmodel);
-            const auto n = update_param<RANGECODER_VERBOSE>(pmodel, index);
-            for (int i = 0; i < n; i++)
-            {
-                shift_byte_buffer();
-            }
-            if constexpr (RANGECODER_VERBOSE)
-            {
-                std::cout << "  decode: " << index << " done" << std::endl;
-                std::cout << std::endl;
-            }
-            return static_cast<int>(index);
-        };
+            return m_bytes.data();
+        }
 
-        void print_status() const
+        auto finish() -> std::vector<byte_t>
         {
-            std::cout << "        range: 0x" << local::hex_zero_filled(range()) << std::endl;
-            std::cout << "  lower bound: 0x" << local::hex_zero_filled(lower_bound()) << std::endl;
-            std::cout << "  upper bound: 0x" << local::hex_zero_filled(upper_bound()) << std::endl;
-            std::cout << "         data: 0x" << local::hex_zero_filled(m_data) << std::endl;
+            return std::move(m_bytes);
         }
 
-        friend std::istream &operator>>(std::istream &is, RangeDecoder &rd)
+        // Drop bytes put, keeping capacity.
+        void reset()
         {
-            rd.start(is);
-            return is;
+            m_bytes.clear();
+        }
+
+    private:
+        std::vector<byte_t> m_bytes;
+    };
+
+    namespace local
+    {
+        // Buffers kept per thread by release_buffer(), beyond which released buffers are freed.
+        constexpr size_t MAX_POOLED_BUFFERS = 8;
+
+        inline auto buffer_pool() -> std::vector<std::vector<byte_t>> &
+        {
+            thread_local auto pool = std::vector<std::vector<byte_t>>();
+            return pool;
+        }
+    }// namespace local
+
+    // Empty buffer, with capacity of one released before on this thread if any.
+    // Used with VectorSink and release_buffer(), repeated messages reuse allocations instead of making new ones:
+    //   encoder.reset(VectorSink(acquire_buffer()));
+    //   ... encode message ...
+    //   auto bytes = encoder.finish();
+    //   ... send bytes ...
+    //   release_buffer(std::move(bytes));
+    inline auto acquire_buffer() -> std::vector<byte_t>
+    {
+        auto &pool = local::buffer_pool();
+        if (pool.empty())
+        {
+            return {};
+        }
+        auto bytes = std::move(pool.back());
+        pool.pop_back();
+        return bytes;
+    }
+
+    // Return bytes to this thread's pool for acquire_buffer().
+    inline void release_buffer(std::vector<byte_t> bytes)
+    {
+        auto &pool = local::buffer_pool();
+        if (pool.size() < local::MAX_POOLED_BUFFERS && bytes.capacity() != 0)
+        {
+            bytes.clear();
+            pool.push_back(std::move(bytes));
+        }
+    }
+
+    // Appends to caller's vector, finish() returns number of bytes appended.
+    class VectorRefSink
+    {
+    public:
+        explicit VectorRefSink(std::vector<byte_t> &bytes) : m_bytes(&bytes), m_offset(bytes.size())
+        {
+        }
+
+        void put(const byte_t byte)
+        {
+            m_bytes->push_back(byte);
+        }
+
+        auto size() const -> size_t
+        {
+            return m_bytes->size() - m_offset;
+        }
+
+        auto data() const -> const byte_t *
+        {
+            return m_bytes->data() + m_offset;
+        }
+
+        auto finish() -> size_t
+        {
+            return size();
+        }
+
+        // Drop bytes appended, keeping bytes in vector before them.
+        void reset()
+        {
+            m_bytes->resize(m_offset);
+        }
+
+    private:
+        std::vector<byte_t> *m_bytes;
+        size_t m_offset;
+    };
+
+    // Writes to caller's preallocated buffer, finish() returns number of bytes written.
+    // Bytes beyond capacity are dropped but still counted,
+    // so overflowed() tells the buffer was too small and size() tells how large it should be.
+    class BufferSink
+    {
+    public:
+        BufferSink(byte_t *buffer, const size_t capacity) : m_buffer(buffer), m_capacity(capacity), m_size(0)
+        {
+        }
+
+        void put(const byte_t byte)
+        {
+            if (m_size < m_capacity)
+            {
+                m_buffer[m_size] = byte;
+            }
+            m_size++;
+        }
+
+        // Put top num_bytes bytes of word with one 8 byte store, while buffer has room for it.
+        void put_word(const uint64_t word, const int num_bytes)
+        {
+            if (m_capacity - std::min(m_size, m_capacity) >= 8)
+            {
+                for (auto i = 0; i < 8; i++)
+                {
+                    m_buffer[m_size + i] = static_cast<byte_t>(word >> (56 - 8 * i));
+                }
+                m_size += num_bytes;
+                return;
+            }
+            for (auto i = 0; i < num_bytes; i++)
+            {
+                put(static_cast<byte_t>(word >> (56 - 8 * i)));
+            }
+        }
+
+        auto size() const -> size_t
+        {
+            return m_size;
+        }
+
+        auto data() const -> const byte_t *
+        {
+            return m_buffer;
+        }
+
+        auto overflowed() const -> bool
+        {
+            return m_size > m_capacity;
+        }
+
+        auto finish() -> size_t
+        {
+            return m_size;
+        }
+
+        // Write again from start of buffer.
+        void reset()
+        {
+            m_size = 0;
+        }
+
+    private:
+        byte_t *m_buffer;
+        size_t m_capacity;
+        size_t m_size;
+    };
+
+    // Fixed capacity ring buffer, drained by consumer with read() while encoding.
+    // Bytes put into a full ring are dropped and overflowed() becomes true.
+    // finish() returns total number of bytes put.
+    template<size_t CAPACITY = 4096>
+    class RingSink
+    {
+        static_assert(CAPACITY != 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be power of two");
+
+    public:
+        void put(const byte_t byte)
+        {
+            if (m_head - m_tail < CAPACITY)
+            {
+                m_buffer[m_head % CAPACITY] = byte;
+                m_head++;
+            }
+            else
+            {
+                m_overflowed = true;
+            }
+            m_size++;
+        }
+
+        auto size() const -> size_t
+        {
+            return m_size;
+        }
+
+        // Number of bytes put but not read yet.
+        auto available() const -> size_t
+        {
+            return m_head - m_tail;
+        }
+
+        // Read at most n bytes into out, returns number of bytes read.
+        auto read(byte_t *out, const size_t n) -> size_t
+        {
+            const auto num_bytes = std::min(n, available());
+            for (size_t i = 0; i < num_bytes; i++)
+            {
+                out[i] = m_buffer[(m_tail + i) % CAPACITY];
+            }
+            m_tail += num_bytes;
+            return num_bytes;
+        }
+
+        auto overflowed() const -> bool
+        {
+            return m_overflowed;
+        }
+
+        auto finish() -> size_t
+        {
+            return m_size;
+        }
+
+    private:
+        byte_t m_buffer[CAPACITY];
+        size_t m_head = 0;
+        size_t m_tail = 0;
+        size_t m_size = 0;
+        bool m_overflowed = false;
+    };
+
+    // Writes to ostream through fixed size buffer, finish() flushes and returns number of bytes written.
+    // Coder is carryless, so bytes are final once put and memory stays constant however long the stream is.
+    // buffer_size 0 is taken as 1, i.e. every byte is written as put.
+    // Bytes of a failed write are not counted and failed() becomes true; callers must check it after finish().
+    class OStreamSink
+    {
+    public:
+        explicit OStreamSink(std::ostream &os, const size_t buffer_size = size_t(1) << 16)
+            : m_os(&os), m_buffer(std::max(buffer_size, size_t(1))), m_buffered(0), m_written(0), m_failed(false)
+        {
+        }
+
+        void put(const byte_t byte)
+        {
+            m_buffer[m_buffered++] = byte;
+            if (m_buffered == m_buffer.size())
+            {
+                flush();
+            }
+        }
+
+        auto size() const -> size_t
+        {
+            return m_written + m_buffered;
+        }
+
+        void flush()
+        {
+            if (m_buffered != 0 && m_os->write(reinterpret_cast<const char *>(m_buffer.data()), static_cast<std::streamsize>(m_buffered)))
+            {
+                m_written += m_buffered;
+            }
+            m_failed = m_failed || !*m_os;
+            m_buffered = 0;
+        }
+
+        auto failed() const -> bool
+        {
+            return m_failed;
+        }
+
+        auto finish() -> size_t
+        {
+            flush();
+            m_failed = m_failed || !m_os->flush();
+            return m_written;
+        }
+
+    private:
+        std::ostream *m_os;
+        std::vector<byte_t> m_buffer;
+        size_t m_buffered;
+        size_t m_written;
+        bool m_failed;
+    };
+
+    namespace local
+    {
+        template<class ByteSink, class = void>
+        struct has_data : std::false_type
+        {
+        };
+
+        template<class ByteSink>
+        struct has_data<ByteSink, std::void_t<decltype(std::declval<const ByteSink &>().data())>> : std::true_type
+        {
+        };
+
+        template<class ByteSink, class = void>
+        struct has_put_word : std::false_type
+        {
+        };
+
+        // Sinks that can store several bytes at once provide `void put_word(uint64_t word, int num_bytes)`,
+        // which puts top num_bytes bytes of word, num_bytes in [0, 8).
+        template<class ByteSink>
+        struct has_put_word<ByteSink, std::void_t<decltype(std::declval<ByteSink &>().put_word(uint64_t(), 0))>> : std::true_type
+        {
+        };
+
+        template<class ByteSink, class = void>
+        struct has_reset : std::false_type
+        {
+        };
+
+        // Sinks that can be reused for another stream provide `void reset()`, which drops bytes put.
+        template<class ByteSink>
+        struct has_reset<ByteSink, std::void_t<decltype(std::declval<ByteSink &>().reset())>> : std::true_type
+        {
+        };
+    }// namespace local
+
+    // Coder state between two symbols, from which BasicRangeDecoder can start decoding.
+    template<class State = range_t>
+    struct BasicCheckpoint
+    {
+        // Number of bytes put into sink before checkpoint.
+        size_t offset;
+        State lower_bound;
+        State range;
+    };
+
+    using Checkpoint = BasicCheckpoint<>;
+
+    // State, UNIT_BITS and BRANCHLESS select coder core, see local::RangeCoder.
+    // Default 64 bit state and 8 bit unit is the stream format of RangeDecoder.
+    template<class ByteSink = VectorSink, class Statistics = NoStatistics, class State = range_t, int UNIT_BITS = 8, bool BRANCHLESS = false>
+    class BasicRangeEncoder : local::RangeCoder<Statistics, State, UNIT_BITS, BRANCHLESS>
+    {
+        using Coder = local::RangeCoder<Statistics, State, UNIT_BITS, BRANCHLESS>;
+        using Coder::lower_bound;
+        using Coder::range;
+        using Coder::upper_bound;
+
+    public:
+        using Coder::statistics;
+
+        BasicRangeEncoder() = default;
+
+        explicit BasicRangeEncoder(ByteSink sink) : m_sink(std::move(sink))
+        {
+        }
+
+        // Returns number of bytes stabled.
+        // PModelT is either PModel (virtual dispatch) or any type with the same member functions.
+        // Concrete models whose member functions are final (or not virtual at all) are inlined.
+        template<RangeCoderVerbose RANGECODER_VERBOSE = SILENT, class PModelT>
+        auto encode(const PModelT &pmodel, const int index) -> int
+        {
+            if constexpr (RANGECODER_VERBOSE)
+            {
+                std::cout << "  encode: " << index << std::endl;
+                print_status();
+            }
+            const auto range_per_total = local::range_per_total<PModelT>(range(), local::total_freq(pmodel));
+            const auto n = this->template update_param<RANGECODER_VERBOSE>(
+                range_per_total, pmodel.c_freq(index), pmodel.cum_freq(index), [this](auto bits, auto num_units) { put_units(m_sink, bits, num_units); });
+            if constexpr (RANGECODER_VERBOSE)
+            {
+                std::cout << "  encode: " << index << " done" << std::endl
+                          << std::endl;
+            }
+            return n;
+        };
+
+        // Encode bit with probability from bit_model, and update bit_model.
+        void encode_bit(BitModel &bit_model, const int bit)
+        {
+            const auto range_per_total = range() >> BitModel::PROB_BITS;
+            const auto prob = bit_model.probability();
+            if (bit)
+            {
+                this->template update_param<SILENT>(range_per_total, (range_t(1) << BitModel::PROB_BITS) - prob, prob, [this](auto bits, auto num_units) { put_units(m_sink, bits, num_units); });
+            }
+            else
+            {
+                this->template update_param<SILENT>(range_per_total, prob, 0, [this](auto bits, auto num_units) { put_units(m_sink, bits, num_units); });
+            }
+            bit_model.update(bit);
+        }
+
+        // Encode low num_bits bits of value, num_bits in [0, 64], as uniform raw bits without model.
+        // Range is split by shift, BYPASS_BITS bits at a time from most significant, which keeps precision of range.
+        void encode_bits(const uint64_t value, const int num_bits)
+        {
+            for (auto shift = num_bits; shift > 0; shift -= Coder::BYPASS_BITS)
+            {
+                const auto chunk_bits = std::min(shift, Coder::BYPASS_BITS);
+                const auto chunk = (value >> (shift - chunk_bits)) & ((range_t(1) << chunk_bits) - 1);
+                this->template update_param<SILENT>(range() >> chunk_bits, 1, chunk, [this](auto bits, auto num_units) { put_units(m_sink, bits, num_units); });
+            }
+        }
+
+        // Encode symbol in [0, 2^NUM_BITS) with bit_tree, and update bit_tree.
+        template<int NUM_BITS>
+        void encode_bit_tree(BitTreeModel<NUM_BITS> &bit_tree, const int symbol)
+        {
+            auto node = 1;
+            for (auto i = NUM_BITS - 1; i >= 0; i--)
+            {
+                const auto bit = (symbol >> i) & 1;
+                encode_bit(bit_tree.bit_model(node), bit);
+                node = (node << 1) | bit;
+            }
+        }
+
+        // Encode indices in [first, last) with pmodel, which must not change while encoding.
+        // Returns number of bytes stabled.
+        template<class PModelT>
+        auto encode(const PModelT &pmodel, const int *first, const int *last) -> int
+        {
+            // Coder state is copied to local, so it stays in registers for whole batch.
+            auto coder = static_cast<const Coder &>(*this);
+            auto &sink = m_sink;
+            const auto total_freq = local::total_freq(pmodel);
+            auto n = 0;
+            for (; first != last; ++first)
+            {
+                const auto range_per_total = local::range_per_total<PModelT>(coder.range(), total_freq);
+                n += coder.template update_param<SILENT>(
+                    range_per_total, pmodel.c_freq(*first), pmodel.cum_freq(*first), [&sink](auto bits, auto num_units) { put_units(sink, bits, num_units); });
+            }
+            static_cast<Coder &>(*this) = coder;
+            return n;
+        }
+
+        // Encode indices in [first, last) like encode, and append checkpoint before every interval-th index,
+        // i.e. checkpoint k is before first[k * interval].
+        template<class PModelT>
+        auto encode(const PModelT &pmodel, const int *first, const int *last, const size_t interval, std::vector<BasicCheckpoint<State>> &checkpoints) -> int
+        {
+            auto n = 0;
+            while (first != last)
+            {
+                checkpoints.push_back(checkpoint());
+                const auto chunk_last = first + std::min(interval, static_cast<size_t>(last - first));
+                n += encode(pmodel, first, chunk_last);
+                first = chunk_last;
+            }
+            return n;
+        }
+
+        // State before next encoded symbol.
+        auto checkpoint() const -> BasicCheckpoint<State>
+        {
+            return {m_sink.size(), lower_bound(), range()};
+        }
+
+        // Flush remaining bytes into sink, and returns sink's finish(),
+        // i.e. encoded bytes for VectorSink (moved, not copied), number of bytes for other sinks.
+        template<RangeCoderVerbose RANGECODER_VERBOSE = SILENT>
+        auto finish() -> decltype(std::declval<ByteSink &>().finish())
+        {
+            for (auto i = 0; i < Coder::UNITS_PER_STATE; i++)
+            {
+                put_unit(m_sink, this->template shift_unit<RANGECODER_VERBOSE>());
+            }
+            return m_sink.finish();
+        }
+
+        auto sink() -> ByteSink &
+        {
+            return m_sink;
+        }
+
+        // Start new stream as if newly constructed, statistics included, while sink keeps its allocated capacity.
+        void reset()
+        {
+            static_assert(local::has_reset<ByteSink>::value, "ByteSink must have reset(), or use reset(ByteSink)");
+            m_sink.reset();
+            *this = BasicRangeEncoder(std::move(m_sink));
+        }
+
+        // Start new stream into sink, e.g. VectorSink(acquire_buffer()) after finish() moved buffer out.
+        void reset(ByteSink sink)
+        {
+            *this = BasicRangeEncoder(std::move(sink));
+        }
+
+        // Finish and write all encoded bytes to ostream.
+        // To write while encoding, with bounded memory, use BasicRangeEncoder<OStreamSink> instead.
+        friend std::ostream &operator<<(std::ostream &os, BasicRangeEncoder &re)
+        {
+            const auto data = re.finish();
+            os.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+            return os;
+        }
+
+        void print_status() const
+        {
+            std::cout << "        range: 0x" << local::hex_zero_filled(range()) << std::endl;
+            std::cout << "  lower bound: 0x" << local::hex_zero_filled(lower_bound()) << std::endl;
+            std::cout << "  upper bound: 0x" << local::hex_zero_filled(upper_bound()) << std::endl;
+            if (m_sink.size() == 0)
+            {
+                std::cout << "        bytes: NULL" << std::endl;
+            }
+            else if constexpr (local::has_data<ByteSink>::value)
+            {
+                std::cout << "        bytes: 0x";
+                for (size_t i = 0; i < m_sink.size(); i++)
+                {
+                    std::cout << local::hex_zero_filled(m_sink.data()[i]);
+                }
+                std::cout << std::endl;
+            }
+            else
+            {
+                std::cout << "        bytes: " << m_sink.size() << " bytes" << std::endl;
+            }
+        }
+
+    private:
+        // Units are written big endian, so stream of wide units is still a byte stream.
+        static void put_unit(ByteSink &sink, const typename Coder::unit_t unit)
+        {
+            for (auto i = Coder::UNIT_BYTES - 1; i >= 0; i--)
+            {
+                sink.put(static_cast<byte_t>(unit >> (8 * i)));
+            }
+        }
+
+        // Put top num_units units of bits, with one word store per symbol if sink supports it.
+        static void put_units(ByteSink &sink, const State bits, const int num_units)
+        {
+            if constexpr (Coder::BRANCHLESS_RENORMALIZATION && local::has_put_word<ByteSink>::value && sizeof(State) == 8)
+            {
+                sink.put_word(bits, num_units * Coder::UNIT_BYTES);
+            }
+            else
+            {
+                Coder::for_each_byte(bits, num_units, [&sink](const byte_t byte) { sink.put(byte); });
+            }
+        }
+
+        ByteSink m_sink;
+    };
+
+    using RangeEncoder = BasicRangeEncoder<VectorSink>;
+
+    // State and UNIT_BITS must be same as BasicRangeEncoder used to encode, BRANCHLESS may differ.
+    template<class Statistics = NoStatistics, class State = range_t, int UNIT_BITS = 8, bool BRANCHLESS = false>
+    class BasicRangeDecoder : local::RangeCoder<Statistics, State, UNIT_BITS, BRANCHLESS>
+    {
+        using Coder = local::RangeCoder<Statistics, State, UNIT_BITS, BRANCHLESS>;
+        using Coder::lower_bound;
+        using Coder::range;
+        using Coder::upper_bound;
+
+    public:
+        using Coder::statistics;
+
+        // Read bytes from istream on demand, buffer_size bytes at a time.
+        // is must outlive decoding, and may be read up to buffer_size bytes past the encoded bytes.
+        // buffer_size 0 is taken as 1, i.e. every byte is read as needed.
+        void start(std::istream &is, const size_t buffer_size = size_t(1) << 16)
+        {
+            m_buffer.resize(std::max(buffer_size, size_t(1)));
+            m_is = &is;
+            m_cursor = m_end = m_buffer.data();
+            start_decoding();
+        }
+
+        void start(std::queue<byte_t> bytes)
+        {
+            m_buffer.clear();
+            while (!bytes.empty())
+            {
+                m_buffer.push_back(bytes.front());
+                bytes.pop();
+            }
+            start(m_buffer.data(), m_buffer.size());
+        };
+
+        void start(const std::vector<byte_t> &bytes)
+        {
+            m_buffer.assign(bytes.begin(), bytes.end());
+            start(m_buffer.data(), m_buffer.size());
+        };
+
+        // Drop input of previous stream, as if newly constructed, statistics included,
+        // keeping capacity of buffer owned for queue, vector or istream input.
+        // start() alone also begins new stream, reset() releases input and statistics.
+        void reset()
+        {
+            static_cast<Coder &>(*this) = Coder();
+            m_buffer.clear();
+            m_is = nullptr;
+            m_cursor = m_end = nullptr;
+            m_data = 0;
+        }
+
+        // Decode directly from caller owned memory, without copy.
+        // bytes must outlive decoding.
+        void start(const byte_t *bytes, const size_t size)
+        {
+            m_is = nullptr;
+            m_cursor = bytes;
+            m_end = bytes + size;
+            start_decoding();
+        };
+
+        // Decode from checkpoint taken by encoder of bytes, so next decoded index is the one after checkpoint.
+        // bytes must outlive decoding.
+        void start(const byte_t *bytes, const size_t size, const BasicCheckpoint<State> &checkpoint)
+        {
+            start(bytes + std::min(size, checkpoint.offset), size - std::min(size, checkpoint.offset));
+            lower_bound(checkpoint.lower_bound);
+            range(checkpoint.range);
+        }
+
+        // Returns index of pmodel used to encode.
+        // pmodel **must** be same as used to encode.
+        // PModelT follows the same rule as RangeEncoder::encode.
+        template<RangeCoderVerbose RANGECODER_VERBOSE = SILENT, class PModelT>
+        auto decode(const PModelT &pmodel) -> int
+        {
+            if constexpr (RANGECODER_VERBOSE)
+            {
+                std::cout << "  decode: unknown " << std::endl;
+                print_status();
+            }
+            const auto range_per_total = local::range_per_total<PModelT>(range(), local::total_freq(pmodel));
+            auto index = 0;
+            if constexpr (local::has_find_index<PModelT>::value && !RANGECODER_VERBOSE)
+            {
+                index = pmodel.find_index(static_cast<range_t>((m_data - lower_bound()) / range_per_total));
+            }
+            else
+            {
+                index = binary_search_encoded_index<RANGECODER_VERBOSE>(pmodel, range_per_total);
+            }
+            this->template update_param<RANGECODER_VERBOSE>(range_per_total, pmodel.c_freq(index), pmodel.cum_freq(index), [this](auto, auto num_units) { shift_units(m_data, m_cursor, m_end, num_units); });
+            if constexpr (RANGECODER_VERBOSE)
+            {
+                std::cout << "  decode: " << index << " done" << std::endl;
+                std::cout << std::endl;
+            }
+            return static_cast<int>(index);
+        };
+
+        // Decode bit encoded by RangeEncoder::encode_bit, and update bit_model.
+        auto decode_bit(BitModel &bit_model) -> int
+        {
+            const auto range_per_total = range() >> BitModel::PROB_BITS;
+            const auto prob = bit_model.probability();
+            const auto bit = m_data - lower_bound() >= range_per_total * prob ? 1 : 0;
+            if (bit)
+            {
+                this->template update_param<SILENT>(range_per_total, (range_t(1) << BitModel::PROB_BITS) - prob, prob, [this](auto, auto num_units) { shift_units(m_data, m_cursor, m_end, num_units); });
+            }
+            else
+            {
+                this->template update_param<SILENT>(range_per_total, prob, 0, [this](auto, auto num_units) { shift_units(m_data, m_cursor, m_end, num_units); });
+            }
+            bit_model.update(bit);
+            return bit;
+        }
+
+        // Decode num_bits bits encoded by RangeEncoder::encode_bits.
+        auto decode_bits(const int num_bits) -> uint64_t
+        {
+            auto value = uint64_t(0);
+            for (auto shift = num_bits; shift > 0; shift -= Coder::BYPASS_BITS)
+            {
+                const auto chunk_bits = std::min(shift, Coder::BYPASS_BITS);
+                const auto range_per_total = range() >> chunk_bits;
+                const auto chunk = static_cast<range_t>(std::min((m_data - lower_bound()) / range_per_total, (State(1) << chunk_bits) - 1));
+                this->template update_param<SILENT>(range_per_total, 1, chunk, [this](auto, auto num_units) { shift_units(m_data, m_cursor, m_end, num_units); });
+                value = (value << chunk_bits) | chunk;
+            }
+            return value;
+        }
+
+        // Decode symbol encoded by RangeEncoder::encode_bit_tree, and update bit_tree.
+        template<int NUM_BITS>
+        auto decode_bit_tree(BitTreeModel<NUM_BITS> &bit_tree) -> int
+        {
+            auto node = 1;
+            for (auto i = 0; i < NUM_BITS; i++)
+            {
+                node = (node << 1) | decode_bit(bit_tree.bit_model(node));
+            }
+            return node - (1 << NUM_BITS);
+        }
+
+        // Decode n indices into out with pmodel, which must not change while decoding.
+        template<class PModelT>
+        void decode_n(const PModelT &pmodel, int *out, const size_t n)
+        {
+            // Coder state is copied to local, so it stays in registers for whole batch.
+            auto coder = static_cast<const Coder &>(*this);
+            auto data = m_data;
+            auto cursor = m_cursor;
+            auto end = m_end;
+            const auto total_freq = local::total_freq(pmodel);
+            const auto min_index = pmodel.min_index();
+            const auto max_index = pmodel.max_index();
+            for (size_t i = 0; i < n; i++)
+            {
+                const auto range_per_total = local::range_per_total<PModelT>(coder.range(), total_freq);
+                const auto f = static_cast<range_t>((data - coder.lower_bound()) / range_per_total);
+                const auto index = local::find_index(pmodel, f, min_index, max_index);
+                out[i] = index;
+                coder.template update_param<SILENT>(
+                    range_per_total, pmodel.c_freq(index), pmodel.cum_freq(index), [this, &data, &cursor, &end](auto, auto num_units) { shift_units(data, cursor, end, num_units); });
+            }
+            static_cast<Coder &>(*this) = coder;
+            m_data = data;
+            m_cursor = cursor;
+            m_end = end;
+        }
+
+        void print_status() const
+        {
+            std::cout << "        range: 0x" << local::hex_zero_filled(range()) << std::endl;
+            std::cout << "  lower bound: 0x" << local::hex_zero_filled(lower_bound()) << std::endl;
+            std::cout << "  upper bound: 0x" << local::hex_zero_filled(upper_bound()) << std::endl;
+            std::cout << "         data: 0x" << local::hex_zero_filled(m_data) << std::endl;
+        }
+
+        friend std::istream &operator>>(std::istream &is, BasicRangeDecoder &rd)
+        {
+            rd.start(is);
+            return is;
         }
 
     private:
         // binary search encoded index
-        template<RangeCoderVerbose RANGECODER_VERBOSE>
-        auto binary_search_encoded_index(const PModel &pmodel) const -> int
+        template<RangeCoderVerbose RANGECODER_VERBOSE, class PModelT>
+        auto binary_search_encoded_index(const PModelT &pmodel, const State range_per_total) const -> int
+        {
+            auto left = pmodel.min_index();
+            auto right = pmodel.max_index();
+            const auto f = static_cast<range_t>((m_data - lower_bound()) / range_per_total);
+
+            if constexpr (RANGECODER_VERBOSE)
+            {
+                std::cout << "  --------- BINARY SEARCH ---------" << std::endl;
+                std::cout << "  find cum: (data: 0x"
+                          << local::hex_zero_filled(m_data)
+                          << " - lower bound: 0x"
+                          << local::hex_zero_filled(lower_bound())
+                          << ")"
+                          << std::endl
+                          << "            / range_per_total: 0x"
+                          << local::hex_zero_filled(range_per_total)
+                          << " = "
+                          << f
+                          << std::endl;
+                std::cout << "  binary search encoded index: " << left << " " << right << std::endl;
+            }
+
+            while (left < right)
+            {
+                const auto mid = left + (right - left) / 2;
+                const auto mid_cum = pmodel.cum_freq(mid + 1);
+
+                if constexpr (RANGECODER_VERBOSE)
+                {
+                    std::cout << "  middle index: (left: " << left << ", right: " << right << ") = " << mid
+                              << ", cum at middle: " << mid_cum << std::endl;
+                }
+
+                if (mid_cum <= f)
+                {
+                    if constexpr (RANGECODER_VERBOSE)
+                    {
+                        std::cout << "  target contains between left:" << left << " middle: " << mid << std::endl;
+                    }
+                    left = mid + 1;
+                }
+                else
+                {
+                    if constexpr (RANGECODER_VERBOSE)
+                    {
+                        std::cout << "  target contains between middle:" << mid << " right: " << right << std::endl;
+                    }
+                    right = mid;
+                }
+            }
+            if constexpr (RANGECODER_VERBOSE)
+            {
+                std::cout << "  find! left: " << left << "= right: " << right << std::endl;
+                std::cout << "  --------- BINARY SEARCH FINISH ---------" << std::endl;
+            }
+            return left;
+        };
+
+        void start_decoding()
+        {
+            lower_bound(0);
+            range(~State(0));
+
+            shift_units(m_data, m_cursor, m_end, Coder::UNITS_PER_STATE);
+        }
+
+        // Shift num_units units into data, read big endian as written by BasicRangeEncoder.
+        // Bytes past the end of input are read as 0.
+        void shift_units(State &data, const byte_t *&cursor, const byte_t *&end, const int num_units)
+        {
+            const auto num_bytes = num_units * Coder::UNIT_BYTES;
+            if constexpr (Coder::BRANCHLESS_RENORMALIZATION && sizeof(State) == 8)
+            {
+                // Symbol shifts at most 7 bytes, so one 8 byte load covers them unless input is near its end.
+                if (end - cursor >= 8 && num_bytes < 8)
+                {
+                    auto word = uint64_t(0);
+                    for (auto i = 0; i < 8; i++)
+                    {
+                        word = (word << 8) | cursor[i];
+                    }
+                    // Shifted in two steps, since shift by 64 is undefined when num_bytes is 0.
+                    data = (data << (8 * num_bytes)) | ((word >> 1) >> (63 - 8 * num_bytes));
+                    cursor += num_bytes;
+                    return;
+                }
+            }
+            for (auto i = 0; i < num_bytes; i++)
+            {
+                if (cursor == end)
+                {
+                    refill(cursor, end);
+                }
+                const auto front_byte = cursor != end ? *cursor++ : byte_t(0);
+                data = (data << 8) | static_cast<State>(front_byte);
+            }
+        }
+
+        // Read next bytes from istream into buffer, if decoding from istream.
+        void refill(const byte_t *&cursor, const byte_t *&end)
+        {
+            if (m_is == nullptr)
+            {
+                return;
+            }
+            m_is->read(reinterpret_cast<char *>(m_buffer.data()), static_cast<std::streamsize>(m_buffer.size()));
+            const auto num_bytes = static_cast<size_t>(m_is->gcount());
+            if (num_bytes == 0)
+            {
+                m_is = nullptr;
+            }
+            cursor = m_buffer.data();
+            end = m_buffer.data() + num_bytes;
+        }
+
+        // Owns input given by queue or vector, or refill buffer for istream.
+        // Unused when decoding from caller owned memory.
+        std::vector<byte_t> m_buffer;
+        std::istream *m_is = nullptr;
+        const byte_t *m_cursor = nullptr;
+        const byte_t *m_end = nullptr;
+        State m_data;
+    };
+
+    using RangeDecoder = BasicRangeDecoder<>;
+
+    namespace local
+    {
+        // Carry propagating coder keeps 56 bits of lower bound in a window below carry bit,
+        // and renormalizes when range drops below 48 bits.
+        constexpr auto CARRY_TOP = range_t(1) << 56;
+        constexpr auto CARRY_BOTTOM = range_t(1) << 48;
+    }// namespace local
+
+    // Range encoder with carry propagation, alternative to carryless RangeEncoder.
+    // Carry out of lower bound is added to bytes not yet written: last byte shifted out is cached,
+    // and following 0xff bytes are only counted, so no coding space is lost to range reduction.
+    // Stream is not compatible with RangeDecoder, use CarryRangeDecoder.
+    template<class ByteSink = VectorSink>
+    class BasicCarryRangeEncoder
+    {
+    public:
+        BasicCarryRangeEncoder() = default;
+
+        explicit BasicCarryRangeEncoder(ByteSink sink) : m_sink(std::move(sink))
+        {
+        }
+
+        template<class PModelT>
+        void encode(const PModelT &pmodel, const int index)
+        {
+            encode_with(pmodel, local::total_freq(pmodel), index);
+        }
+
+        // Encode indices in [first, last) with pmodel, which must not change while encoding.
+        template<class PModelT>
+        void encode(const PModelT &pmodel, const int *first, const int *last)
+        {
+            const auto total_freq = local::total_freq(pmodel);
+            for (; first != last; ++first)
+            {
+                encode_with(pmodel, total_freq, *first);
+            }
+        }
+
+        // Flush remaining bytes into sink, and returns sink's finish().
+        auto finish() -> decltype(std::declval<ByteSink &>().finish())
+        {
+            for (auto i = 0; i < 8; i++)
+            {
+                shift_low();
+            }
+            return m_sink.finish();
+        }
+
+        auto sink() -> ByteSink &
+        {
+            return m_sink;
+        }
+
+        // Start new stream as if newly constructed, while sink keeps its allocated capacity.
+        void reset()
+        {
+            static_assert(local::has_reset<ByteSink>::value, "ByteSink must have reset(), or use reset(ByteSink)");
+            m_sink.reset();
+            *this = BasicCarryRangeEncoder(std::move(m_sink));
+        }
+
+        void reset(ByteSink sink)
+        {
+            *this = BasicCarryRangeEncoder(std::move(sink));
+        }
+
+    private:
+        template<class PModelT>
+        void encode_with(const PModelT &pmodel, const range_t total_freq, const int index)
+        {
+            const auto range_per_total = local::range_per_total<PModelT>(m_range, total_freq);
+            m_low += range_per_total * pmodel.cum_freq(index);
+            m_range = range_per_total * pmodel.c_freq(index);
+            while (m_range < local::CARRY_BOTTOM)
+            {
+                m_range <<= 8;
+                shift_low();
+            }
+        }
+
+        // Shift out top byte of lower bound window.
+        // Bytes are written once known not to change by carry, i.e. when the byte is not 0xff or carry occurred.
+        void shift_low()
+        {
+            if (m_low < (range_t(0xff) << 48) || m_low >= local::CARRY_TOP)
+            {
+                const auto carry = static_cast<byte_t>(m_low >> 56);
+                auto byte = m_cache;
+                do
+                {
+                    m_sink.put(static_cast<byte_t>(byte + carry));
+                    byte = 0xff;
+                } while (--m_cache_size != 0);
+                m_cache = static_cast<byte_t>(m_low >> 48);
+            }
+            m_cache_size++;
+            m_low = (m_low & (local::CARRY_BOTTOM - 1)) << 8;
+        }
+
+        ByteSink m_sink;
+        range_t m_low = 0;
+        range_t m_range = local::CARRY_TOP - 1;
+        byte_t m_cache = 0;
+        uint64_t m_cache_size = 1;
+    };
+
+    using CarryRangeEncoder = BasicCarryRangeEncoder<VectorSink>;
+
+    // Decoder for BasicCarryRangeEncoder.
+    class CarryRangeDecoder
+    {
+    public:
+        void start(const std::vector<byte_t> &bytes)
+        {
+            m_buffer.assign(bytes.begin(), bytes.end());
+            start(m_buffer.data(), m_buffer.size());
+        }
+
+        // Decode directly from caller owned memory, without copy.
+        // bytes must outlive decoding.
+        void start(const byte_t *bytes, const size_t size)
+        {
+            m_cursor = bytes;
+            m_end = bytes + size;
+            m_range = local::CARRY_TOP - 1;
+            m_code = 0;
+            for (auto i = 0; i < 8; i++)
+            {
+                shift_byte_buffer();
+            }
+        }
+
+        // Returns index of pmodel used to encode.
+        // pmodel **must** be same as used to encode.
+        template<class PModelT>
+        auto decode(const PModelT &pmodel) -> int
+        {
+            return decode_with(pmodel, local::total_freq(pmodel));
+        }
+
+        // Decode n indices into out with pmodel, which must not change while decoding.
+        template<class PModelT>
+        void decode_n(const PModelT &pmodel, int *out, const size_t n)
+        {
+            const auto total_freq = local::total_freq(pmodel);
+            for (size_t i = 0; i < n; i++)
+            {
+                out[i] = decode_with(pmodel, total_freq);
+            }
+        }
+
+    private:
+        template<class PModelT>
+        auto decode_with(const PModelT &pmodel, const range_t total_freq) -> int
+        {
+            const auto range_per_total = local::range_per_total<PModelT>(m_range, total_freq);
+            const auto f = std::min(m_code / range_per_total, total_freq - 1);
+            const auto index = local::find_index(pmodel, f, pmodel.min_index(), pmodel.max_index());
+            m_code -= range_per_total * pmodel.cum_freq(index);
+            m_range = range_per_total * pmodel.c_freq(index);
+            while (m_range < local::CARRY_BOTTOM)
+            {
+                m_range <<= 8;
+                shift_byte_buffer();
+            }
+            return index;
+        }
+
+        // Bytes past the end of input are read as 0.
+        void shift_byte_buffer()
+        {
+            const auto front_byte = m_cursor != m_end ? *m_cursor++ : byte_t(0);
+            m_code = (m_code << 8) | static_cast<range_t>(front_byte);
+        }
+
+        // Owns input given by vector. Unused when decoding from caller owned memory.
+        std::vector<byte_t> m_buffer;
+        const byte_t *m_cursor = nullptr;
+        const byte_t *m_end = nullptr;
+        // Offset of encoded value from lower bound.
+        range_t m_code = 0;
+        range_t m_range = local::CARRY_TOP - 1;
+    };
+
+    namespace local
+    {
+        inline void put_uint64(std::vector<byte_t> &bytes, const uint64_t value)
+        {
+            for (auto i = 7; i >= 0; i--)
+            {
+                bytes.push_back(static_cast<byte_t>(value >> (8 * i)));
+            }
+        }
+
+        // Read 8 bytes big endian at bytes[offset], missing bytes past size are read as 0.
+        inline auto get_uint64(const byte_t *bytes, const size_t size, const size_t offset) -> uint64_t
+        {
+            auto value = uint64_t(0);
+            for (size_t i = offset; i < offset + 8; i++)
+            {
+                value = (value << 8) | (i < size ? bytes[i] : 0);
+            }
+            return value;
+        }
+    }// namespace local
+
+    // Call f(task) for each task in [0, num_tasks) on num_threads threads, or hardware concurrency if 0.
+    // Tasks are handed out one at a time, so uneven tasks balance. f must not throw.
+    template<class Function>
+    void parallel_for(const size_t num_tasks, unsigned num_threads, const Function &f)
+    {
+        if (num_threads == 0)
+        {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        num_threads = static_cast<unsigned>(std::min<size_t>(num_threads, num_tasks));
+        auto next_task = std::atomic<size_t>(0);
+        auto worker = [&next_task, num_tasks, &f]() {
+            for (auto task = next_task++; task < num_tasks; task = next_task++)
+            {
+                f(task);
+            }
+        };
+        auto threads = std::vector<std::thread>();
+        for (unsigned i = 1; i < num_threads; i++)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    // Encode data[0, n) in blocks of block_size symbols, each block by its own RangeEncoder,
+    // on num_threads threads (hardware concurrency if 0). pmodel is shared by all threads, so it must not change.
+    // Smaller blocks scale better, at cost of 8 bytes of flush and 8 bytes of offset table per block.
+    //
+    // Output layout:
+    //   8 bytes big endian, number of symbols
+    //   8 bytes big endian, block size
+    //   8 bytes big endian per block, number of bytes of block's stream
+    //   followed by each block's stream, in order.
+    // Throws std::invalid_argument if block_size is 0.
+    template<class PModelT>
+    auto parallel_encode(
+        const PModelT &pmodel, const int *data, const size_t n, const size_t block_size = size_t(1) << 20, const unsigned num_threads = 0) -> std::vector<byte_t>
+    {
+        if (block_size == 0)
+        {
+            throw std::invalid_argument("parallel_encode: block_size must be positive");
+        }
+        const auto num_blocks = n / block_size + (n % block_size != 0 ? 1 : 0);
+        auto blocks = std::vector<std::vector<byte_t>>(num_blocks);
+        parallel_for(num_blocks, num_threads, [&](const size_t block) {
+            const auto first = data + block * block_size;
+            const auto last = data + std::min(n, (block + 1) * block_size);
+            auto encoder = RangeEncoder();
+            encoder.encode(pmodel, first, last);
+            blocks[block] = encoder.finish();
+        });
+
+        auto bytes = std::vector<byte_t>();
+        local::put_uint64(bytes, n);
+        local::put_uint64(bytes, block_size);
+        for (const auto &block : blocks)
+        {
+            local::put_uint64(bytes, block.size());
+        }
+        for (const auto &block : blocks)
+        {
+            bytes.insert(bytes.end(), block.begin(), block.end());
+        }
+        return bytes;
+    }
+
+    namespace local
+    {
+        // Number of blocks of parallel_encode output, or 0 if its block table does not fit in bytes.
+        inline auto parallel_num_blocks(const byte_t *bytes, const size_t size) -> size_t
+        {
+            const auto n = get_uint64(bytes, size, 0);
+            const auto block_size = get_uint64(bytes, size, 8);
+            if (size < 16 || block_size == 0)
+            {
+                return 0;
+            }
+            const auto num_blocks = n / block_size + (n % block_size != 0 ? 1 : 0);
+            return num_blocks <= (size - 16) / 8 ? num_blocks : 0;
+        }
+    }// namespace local
+
+    // Number of symbols encoded by parallel_encode, or 0 if bytes is not its output.
+    inline auto parallel_decoded_size(const byte_t *bytes, const size_t size) -> size_t
+    {
+        return local::parallel_num_blocks(bytes, size) != 0 ? local::get_uint64(bytes, size, 0) : 0;
+    }
+
+    // Decode bytes encoded by parallel_encode into out, which must have room for parallel_decoded_size symbols,
+    // on num_threads threads (hardware concurrency if 0). pmodel must be same as used to encode.
+    // Returns false, without decoding, if header of bytes is malformed.
+    template<class PModelT>
+    auto parallel_decode(const PModelT &pmodel, const byte_t *bytes, const size_t size, int *out, const unsigned num_threads = 0) -> bool
+    {
+        const auto n = parallel_decoded_size(bytes, size);
+        const auto block_size = local::get_uint64(bytes, size, 8);
+        if (n == 0)
+        {
+            return size >= 16 && local::get_uint64(bytes, size, 0) == 0;
+        }
+        const auto num_blocks = local::parallel_num_blocks(bytes, size);
+        auto offsets = std::vector<size_t>(num_blocks + 1);
+        offsets[0] = 16 + 8 * num_blocks;
+        for (size_t block = 0; block < num_blocks; block++)
+        {
+            const auto length = local::get_uint64(bytes, size, 16 + 8 * block);
+            if (length > size - offsets[block])
+            {
+                return false;
+            }
+            offsets[block + 1] = offsets[block] + length;
+        }
+        parallel_for(num_blocks, num_threads, [&](const size_t block) {
+            auto decoder = RangeDecoder();
+            decoder.start(bytes + offsets[block], offsets[block + 1] - offsets[block]);
+            const auto first = block * block_size;
+            decoder.decode_n(pmodel, out + first, std::min(n, first + block_size) - first);
+        });
+        return true;
+    }
+
+    namespace local
+    {
+        inline void put_uint32(std::vector<byte_t> &bytes, const uint32_t value)
+        {
+            for (auto i = 3; i >= 0; i--)
+            {
+                bytes.push_back(static_cast<byte_t>(value >> (8 * i)));
+            }
+        }
+
+        inline auto get_uint32(const byte_t *bytes, const size_t size, const size_t offset) -> uint32_t
+        {
+            return static_cast<uint32_t>(get_uint64(bytes, size, offset) >> 32);
+        }
+
+        // 32 bit FNV-1a hash, used as block checksum. Pass previous hash to continue it over more bytes.
+        inline auto fnv1a(const byte_t *bytes, const size_t size, uint32_t hash = 2166136261u) -> uint32_t
+        {
+            for (size_t i = 0; i < size; i++)
+            {
+                hash = (hash ^ bytes[i]) * 16777619u;
+            }
+            return hash;
+        }
+
+        constexpr uint32_t FRAME_MAGIC = 0x52434652;// "RCFR"
+        constexpr byte_t FRAME_CHECKSUM = 1;
+        // Magic and flags byte.
+        constexpr size_t FRAME_HEADER_SIZE = 5;
+        // Number of blocks and magic.
+        constexpr size_t FRAME_TRAILER_SIZE = 12;
+        // Checksum of index, between number of blocks and magic.
+        constexpr size_t FRAME_INDEX_CHECKSUM_SIZE = 4;
+        // Number of symbols and number of bytes of stream.
+        constexpr size_t FRAME_BLOCK_HEADER_SIZE = 16;
+        // Offset of block header and number of first symbol.
+        constexpr size_t FRAME_INDEX_ENTRY_SIZE = 16;
+    }// namespace local
+
+    // Writes framed container of independently decodable blocks.
+    //
+    // Frame layout:
+    //   4 bytes magic "RCFR", 1 byte flags (bit 0 set if frame has checksums)
+    //   per block:
+    //     8 bytes big endian, number of symbols
+    //     8 bytes big endian, number of bytes of stream
+    //     4 bytes big endian, FNV-1a of the 16 bytes above and stream, only with checksum
+    //     stream of a RangeEncoder
+    //   block index, per block:
+    //     8 bytes big endian, offset of block from start of frame
+    //     8 bytes big endian, number of symbols before block
+    //   8 bytes big endian, number of blocks
+    //   4 bytes big endian, FNV-1a of block index and number of blocks, only with checksum
+    //   4 bytes magic "RCFR"
+    class FrameWriter
+    {
+    public:
+        explicit FrameWriter(const bool checksum = true) : m_checksum(checksum)
+        {
+            local::put_uint32(m_bytes, local::FRAME_MAGIC);
+            m_bytes.push_back(checksum ? local::FRAME_CHECKSUM : 0);
+        }
+
+        // Append block of num_symbols symbols already encoded to stream.
+        void add_block(const byte_t *stream, const size_t size, const size_t num_symbols)
+        {
+            const auto offset = m_bytes.size();
+            m_index.push_back({offset, m_num_symbols});
+            m_num_symbols += num_symbols;
+            local::put_uint64(m_bytes, num_symbols);
+            local::put_uint64(m_bytes, size);
+            if (m_checksum)
+            {
+                local::put_uint32(m_bytes, local::fnv1a(stream, size, local::fnv1a(m_bytes.data() + offset, local::FRAME_BLOCK_HEADER_SIZE)));
+            }
+            m_bytes.insert(m_bytes.end(), stream, stream + size);
+        }
+
+        void add_block(const std::vector<byte_t> &stream, const size_t num_symbols)
+        {
+            add_block(stream.data(), stream.size(), num_symbols);
+        }
+
+        // Encode [first, last) with pmodel as new block.
+        template<class PModelT>
+        void encode_block(const PModelT &pmodel, const int *first, const int *last)
+        {
+            auto encoder = RangeEncoder();
+            encoder.encode(pmodel, first, last);
+            add_block(encoder.finish(), static_cast<size_t>(last - first));
+        }
+
+        // Append block index and trailer, and return frame. Writer must not be used after.
+        auto finish() -> std::vector<byte_t>
+        {
+            const auto index_offset = m_bytes.size();
+            for (const auto &entry : m_index)
+            {
+                local::put_uint64(m_bytes, entry.offset);
+                local::put_uint64(m_bytes, entry.first_symbol);
+            }
+            local::put_uint64(m_bytes, m_index.size());
+            if (m_checksum)
+            {
+                local::put_uint32(m_bytes, local::fnv1a(m_bytes.data() + index_offset, m_bytes.size() - index_offset));
+            }
+            local::put_uint32(m_bytes, local::FRAME_MAGIC);
+            return std::move(m_bytes);
+        }
+
+    private:
+        struct IndexEntry
+        {
+            size_t offset;
+            size_t first_symbol;
+        };
+
+        bool m_checksum;
+        size_t m_num_symbols = 0;
+        std::vector<byte_t> m_bytes;
+        std::vector<IndexEntry> m_index;
+    };
+
+    // Reads frame written by FrameWriter from caller owned memory, which must outlive reader.
+    // Blocks are located by trailing index, so any block decodes without reading those before it.
+    class FrameReader
+    {
+    public:
+        // Returns false if bytes is not a whole frame, or its index does not match its checksum,
+        // reader has no blocks then.
+        auto open(const byte_t *bytes, const size_t size) -> bool
+        {
+            m_bytes = bytes;
+            m_blocks.clear();
+            m_num_symbols = 0;
+            if (size < local::FRAME_HEADER_SIZE + local::FRAME_TRAILER_SIZE || local::get_uint32(bytes, size, 0) != local::FRAME_MAGIC ||
+                local::get_uint32(bytes, size, size - 4) != local::FRAME_MAGIC)
+            {
+                return false;
+            }
+            m_checksum = (bytes[4] & local::FRAME_CHECKSUM) != 0;
+            const auto trailer_size = local::FRAME_TRAILER_SIZE + (m_checksum ? local::FRAME_INDEX_CHECKSUM_SIZE : 0);
+            if (size < local::FRAME_HEADER_SIZE + trailer_size)
+            {
+                return false;
+            }
+            const auto num_blocks = local::get_uint64(bytes, size, size - trailer_size);
+            const auto index_space = size - local::FRAME_HEADER_SIZE - trailer_size;
+            if (num_blocks > index_space / local::FRAME_INDEX_ENTRY_SIZE)
+            {
+                return false;
+            }
+            const auto index_offset = size - trailer_size - local::FRAME_INDEX_ENTRY_SIZE * num_blocks;
+            if (m_checksum &&
+                local::fnv1a(bytes + index_offset, size - 8 - index_offset) != local::get_uint32(bytes, size, size - 8))
+            {
+                return false;
+            }
+
+            const auto block_header_size = local::FRAME_BLOCK_HEADER_SIZE + (m_checksum ? size_t(4) : size_t(0));
+            auto blocks = std::vector<Block>(num_blocks);
+            for (size_t i = 0; i < num_blocks; i++)
+            {
+                auto &block = blocks[i];
+                const auto offset = local::get_uint64(bytes, size, index_offset + local::FRAME_INDEX_ENTRY_SIZE * i);
+                if (offset < local::FRAME_HEADER_SIZE || offset > index_offset || index_offset - offset < block_header_size)
+                {
+                    return false;
+                }
+                block.first_symbol = local::get_uint64(bytes, size, index_offset + local::FRAME_INDEX_ENTRY_SIZE * i + 8);
+                block.num_symbols = local::get_uint64(bytes, size, offset);
+                block.stream_size = local::get_uint64(bytes, size, offset + 8);
+                block.checksum = m_checksum ? local::get_uint32(bytes, size, offset + 16) : 0;
+                block.stream_offset = offset + block_header_size;
+                if (block.stream_size > index_offset - block.stream_offset || block.first_symbol != m_num_symbols ||
+                    block.num_symbols > std::numeric_limits<size_t>::max() - m_num_symbols)
+                {
+                    return false;
+                }
+                m_num_symbols += block.num_symbols;
+            }
+            m_blocks = std::move(blocks);
+            return true;
+        }
+
+        auto open(const std::vector<byte_t> &bytes) -> bool
+        {
+            return open(bytes.data(), bytes.size());
+        }
+
+        auto num_blocks() const -> size_t
+        {
+            return m_blocks.size();
+        }
+
+        // Number of symbols of all blocks.
+        auto num_symbols() const -> size_t
+        {
+            return m_num_symbols;
+        }
+
+        auto block_num_symbols(const size_t block) const -> size_t
+        {
+            return m_blocks[block].num_symbols;
+        }
+
+        // Number of symbols before block.
+        auto block_first_symbol(const size_t block) const -> size_t
+        {
+            return m_blocks[block].first_symbol;
+        }
+
+        // Block holding symbol, or num_blocks() if symbol >= num_symbols().
+        auto find_block(const size_t symbol) const -> size_t
+        {
+            const auto it = std::upper_bound(m_blocks.begin(), m_blocks.end(), symbol, [](const size_t s, const Block &block) { return s < block.first_symbol; });
+            if (symbol >= m_num_symbols || it == m_blocks.begin())
+            {
+                return m_blocks.size();
+            }
+            return static_cast<size_t>(it - m_blocks.begin()) - 1;
+        }
+
+        // True if frame has no checksum or block's header and stream match it.
+        auto verify_block(const size_t block) const -> bool
+        {
+            const auto &b = m_blocks[block];
+            const auto header = m_bytes + b.stream_offset - local::FRAME_BLOCK_HEADER_SIZE - 4;
+            return !m_checksum || local::fnv1a(m_bytes + b.stream_offset, b.stream_size, local::fnv1a(header, local::FRAME_BLOCK_HEADER_SIZE)) == b.checksum;
+        }
+
+        // Encoded stream of block, for decoding with own decoder, e.g. with adaptive model.
+        auto block_stream(const size_t block) const -> const byte_t *
+        {
+            return m_bytes + m_blocks[block].stream_offset;
+        }
+
+        auto block_stream_size(const size_t block) const -> size_t
+        {
+            return m_blocks[block].stream_size;
+        }
+
+        // Decode block into out, which must have room for block_num_symbols(block) symbols.
+        // pmodel must be same as used to encode. Returns false, without decoding, if checksum does not match.
+        template<class PModelT>
+        auto decode_block(const PModelT &pmodel, const size_t block, int *out) const -> bool
+        {
+            if (!verify_block(block))
+            {
+                return false;
+            }
+            const auto &b = m_blocks[block];
+            auto decoder = RangeDecoder();
+            decoder.start(m_bytes + b.stream_offset, b.stream_size);
+            decoder.decode_n(pmodel, out, b.num_symbols);
+            return true;
+        }
+
+    private:
+        struct Block
+        {
+            size_t first_symbol;
+            size_t num_symbols;
+            size_t stream_offset;
+            size_t stream_size;
+            uint32_t checksum;
+        };
+
+        const byte_t *m_bytes = nullptr;
+        bool m_checksum = false;
+        size_t m_num_symbols = 0;
+        std::vector<Block> m_blocks;
+    };
+
+    // Encode data[0, n) into frame of blocks of block_size symbols, blocks are encoded on num_threads threads
+    // (hardware concurrency if 0). pmodel is shared by all threads, so it must not change.
+    // Throws std::invalid_argument if block_size is 0.
+    template<class PModelT>
+    auto frame_encode(const PModelT &pmodel, const int *data, const size_t n, const size_t block_size = size_t(1) << 20, const bool checksum = true,
+                      const unsigned num_threads = 0) -> std::vector<byte_t>
+    {
+        if (block_size == 0)
+        {
+            throw std::invalid_argument("frame_encode: block_size must be positive");
+        }
+        const auto num_blocks = n / block_size + (n % block_size != 0 ? 1 : 0);
+        auto blocks = std::vector<std::vector<byte_t>>(num_blocks);
+        parallel_for(num_blocks, num_threads, [&](const size_t block) {
+            auto encoder = RangeEncoder();
+            encoder.encode(pmodel, data + block * block_size, data + std::min(n, (block + 1) * block_size));
+            blocks[block] = encoder.finish();
+        });
+
+        auto writer = FrameWriter(checksum);
+        for (size_t block = 0; block < num_blocks; block++)
+        {
+            writer.add_block(blocks[block], std::min(n, (block + 1) * block_size) - block * block_size);
+        }
+        return writer.finish();
+    }
+
+    // Interleaved coding with NUM_STATES independent coder states.
+    // Symbol i (counted over all encode calls) is coded by state i % NUM_STATES,
+    // so the dependency chains through range and lower bound of each state overlap in CPU pipeline.
+    //
+    // Output layout is one stream with the states' bytes interleaved:
+    //   byte j of state s (as RangeEncoder would write it) is at j * NUM_STATES + s.
+    // Shorter states are padded with 0, which decoder reads past end of a stream anyway.
+    // Position of each byte is fixed when it is put, so the prefix of rows every state has filled is final.
+    template<int NUM_STATES = 4>
+    class InterleavedRangeEncoder
+    {
+        static_assert(NUM_STATES > 0, "NUM_STATES must be positive");
+
+    public:
+        template<class PModelT>
+        void encode(const PModelT &pmodel, const int index)
+        {
+            const auto state = static_cast<int>(m_num_symbols % NUM_STATES);
+            encode_with(m_coders[state], m_sizes[state], m_bytes, state, pmodel, local::total_freq(pmodel), index);
+            m_num_symbols++;
+        }
+
+        // Encode indices in [first, last) with pmodel, which must not change while encoding.
+        template<class PModelT>
+        void encode(const PModelT &pmodel, const int *first, const int *last)
+        {
+            const auto total_freq = local::total_freq(pmodel);
+            // Align to first state, then code NUM_STATES symbols at once with all states in locals.
+            while (first != last && m_num_symbols % NUM_STATES != 0)
+            {
+                encode(pmodel, *first++);
+            }
+            auto coders = m_coders;
+            auto sizes = m_sizes;
+            while (last - first >= NUM_STATES)
+            {
+                for (auto state = 0; state < NUM_STATES; state++)
+                {
+                    encode_with(coders[state], sizes[state], m_bytes, state, pmodel, total_freq, first[state]);
+                }
+                first += NUM_STATES;
+                m_num_symbols += NUM_STATES;
+            }
+            m_coders = coders;
+            m_sizes = sizes;
+            while (first != last)
+            {
+                encode(pmodel, *first++);
+            }
+        }
+
+        auto finish() -> std::vector<byte_t>
+        {
+            for (auto state = 0; state < NUM_STATES; state++)
+            {
+                for (auto i = 0; i < 8; i++)
+                {
+                    put(m_sizes[state], m_bytes, state, m_coders[state].template shift_unit<SILENT>());
+                }
+            }
+            m_bytes.resize(*std::max_element(m_sizes.begin(), m_sizes.end()) * NUM_STATES);
+            return std::move(m_bytes);
+        }
+
+    private:
+        // Put byte as next byte of state. bytes grows by doubling, zero filled, so other states' slots are 0 until put,
+        // and finish() cuts it to the longest state.
+        static void put(size_t &size, std::vector<byte_t> &bytes, const int state, const byte_t byte)
+        {
+            const auto row = size * NUM_STATES;
+            if (row >= bytes.size())
+            {
+                bytes.resize(std::max(row + NUM_STATES, 2 * bytes.size()));
+            }
+            bytes[row + state] = byte;
+            size++;
+        }
+
+        template<class PModelT>
+        static void encode_with(local::RangeCoder<> &coder, size_t &size, std::vector<byte_t> &bytes, const int state, const PModelT &pmodel,
+                                const range_t total_freq, const int index)
+        {
+            const auto range_per_total = local::range_per_total<PModelT>(coder.range(), total_freq);
+            coder.update_param<SILENT>(
+                range_per_total, pmodel.c_freq(index), pmodel.cum_freq(index), [&size, &bytes, state](const range_t bits, const int num_units) {
+                    local::RangeCoder<>::for_each_byte(bits, num_units, [&size, &bytes, state](const byte_t byte) { put(size, bytes, state, byte); });
+                });
+        }
+
+        std::array<local::RangeCoder<>, NUM_STATES> m_coders;
+        // Number of bytes put by each state.
+        std::array<size_t, NUM_STATES> m_sizes = {};
+        std::vector<byte_t> m_bytes;
+        size_t m_num_symbols = 0;
+    };
+
+    // Decoder for InterleavedRangeEncoder with same NUM_STATES.
+    template<int NUM_STATES = 4>
+    class InterleavedRangeDecoder
+    {
+        static_assert(NUM_STATES > 0, "NUM_STATES must be positive");
+
+    public:
+        void start(const std::vector<byte_t> &bytes)
+        {
+            m_buffer = bytes;
+            start(m_buffer.data(), m_buffer.size());
+        }
+
+        // Decode directly from caller owned memory, without copy.
+        // bytes must outlive decoding.
+        void start(const byte_t *bytes, const size_t size)
+        {
+            m_bytes = bytes;
+            m_size = size;
+            for (auto state = 0; state < NUM_STATES; state++)
+            {
+                m_coders[state] = local::RangeCoder<>();
+                m_data[state] = 0;
+                m_positions[state] = static_cast<size_t>(state);
+                for (auto i = 0; i < 8; i++)
+                {
+                    shift_byte_buffer(m_data[state], m_positions[state], m_bytes, m_size);
+                }
+            }
+            m_num_symbols = 0;
+        }
+
+        template<class PModelT>
+        auto decode(const PModelT &pmodel) -> int
+        {
+            const auto state = m_num_symbols % NUM_STATES;
+            m_num_symbols++;
+            return decode_with(m_coders[state], m_data[state], m_positions[state], m_bytes, m_size, pmodel, local::total_freq(pmodel));
+        }
+
+        // Decode n indices into out with pmodel, which must not change while decoding.
+        template<class PModelT>
+        void decode_n(const PModelT &pmodel, int *out, size_t n)
+        {
+            const auto total_freq = local::total_freq(pmodel);
+            // Align to first state, then advance all states together with their state in locals.
+            while (n != 0 && m_num_symbols % NUM_STATES != 0)
+            {
+                *out++ = decode(pmodel);
+                n--;
+            }
+            auto coders = m_coders;
+            auto data = m_data;
+            auto positions = m_positions;
+            const auto bytes = m_bytes;
+            const auto size = m_size;
+            while (n >= NUM_STATES)
+            {
+                for (auto state = 0; state < NUM_STATES; state++)
+                {
+                    out[state] = decode_with(coders[state], data[state], positions[state], bytes, size, pmodel, total_freq);
+                }
+                out += NUM_STATES;
+                n -= NUM_STATES;
+                m_num_symbols += NUM_STATES;
+            }
+            m_coders = coders;
+            m_data = data;
+            m_positions = positions;
+            while (n != 0)
+            {
+                *out++ = decode(pmodel);
+                n--;
+            }
+        }
+
+    private:
+        // Shift in state's byte at position, which steps over other states' bytes. Bytes past the end are read as 0.
+        static void shift_byte_buffer(range_t &data, size_t &position, const byte_t *bytes, const size_t size)
+        {
+            const auto front_byte = position < size ? bytes[position] : byte_t(0);
+            position += NUM_STATES;
+            data = (data << 8) | static_cast<range_t>(front_byte);
+        }
+
+        template<class PModelT>
+        static auto decode_with(local::RangeCoder<> &coder, range_t &data, size_t &position, const byte_t *bytes, const size_t size, const PModelT &pmodel,
+                                const range_t total_freq) -> int
+        {
+            const auto range_per_total = local::range_per_total<PModelT>(coder.range(), total_freq);
+            const auto f = (data - coder.lower_bound()) / range_per_total;
+            const auto index = local::find_index(pmodel, f, pmodel.min_index(), pmodel.max_index());
+            coder.update_param<SILENT>(
+                range_per_total, pmodel.c_freq(index), pmodel.cum_freq(index), [&data, &position, bytes, size](range_t, const int num_units) {
+                    for (auto i = 0; i < num_units; i++)
+                    {
+                        shift_byte_buffer(data, position, bytes, size);
+                    }
+                });
+            return index;
+        }
+
+        // Owns input given by vector. Unused when decoding from caller owned memory.
+        std::vector<byte_t> m_buffer;
+        std::array<local::RangeCoder<>, NUM_STATES> m_coders;
+        std::array<range_t, NUM_STATES> m_data;
+        // Position of next byte of each state.
+        std::array<size_t, NUM_STATES> m_positions;
+        const byte_t *m_bytes = nullptr;
+        size_t m_size = 0;
+        size_t m_num_symbols = 0;
+    };
+
+    // Scale freq so that its sum is exactly 2^total_freq_bits, keeping every non zero frequency non zero.
+    // Returns empty vector if there are more non zero frequencies than 2^total_freq_bits.
+    inline auto normalize_freq(const std::vector<range_t> &freq, const int total_freq_bits) -> std::vector<range_t>
+    {
+        const auto target = range_t(1) << total_freq_bits;
+        auto sum = range_t(0);
+        auto num_nonzero = range_t(0);
+        for (const auto f : freq)
+        {
+            sum += f;
+            num_nonzero += f != 0 ? 1 : 0;
+        }
+        if (num_nonzero == 0 || num_nonzero > target)
+        {
+            return {};
+        }
+
+        auto normalized = std::vector<range_t>(freq.size(), 0);
+        auto normalized_sum = range_t(0);
+        const auto scale = static_cast<double>(target) / static_cast<double>(sum);
+        for (size_t i = 0; i < freq.size(); i++)
+        {
+            if (freq[i] != 0)
+            {
+                normalized[i] = std::max(range_t(1), static_cast<range_t>(static_cast<double>(freq[i]) * scale));
+                normalized_sum += normalized[i];
+            }
+        }
+
+        // Fix rounding error, taking from or giving to most frequent symbols where it costs least.
+        auto order = std::vector<size_t>(freq.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&normalized](auto a, auto b) { return normalized[a] > normalized[b]; });
+        if (normalized_sum < target)
+        {
+            normalized[order[0]] += target - normalized_sum;
+        }
+        while (normalized_sum > target)
+        {
+            for (const auto i : order)
+            {
+                if (normalized_sum == target || normalized[i] <= 1)
+                {
+                    break;
+                }
+                normalized[i]--;
+                normalized_sum--;
+            }
+        }
+        return normalized;
+    }
+
+    // Static frequency table for indices [min_index, min_index + freq.size()).
+    class FrequencyTable : public PModel
+    {
+    public:
+        FrequencyTable() = default;
+
+        explicit FrequencyTable(const std::vector<range_t> &freq, const int min_index = 0)
+            : m_min_index(min_index), m_cum_freq(freq.size() + 1, 0)
+        {
+            for (size_t i = 0; i < freq.size(); i++)
+            {
+                m_cum_freq[i + 1] = m_cum_freq[i] + freq[i];
+            }
+        }
+
+        // Table from cumulative frequencies, cum_freq[0] = 0 and cum_freq.back() = total, taken as is.
+        static auto from_cum_freq(std::vector<range_t> cum_freq, const int min_index = 0) -> FrequencyTable
+        {
+            auto table = FrequencyTable();
+            table.m_min_index = min_index;
+            table.m_cum_freq = std::move(cum_freq);
+            return table;
+        }
+
+        range_t c_freq(const int index) const override final
+        {
+            return m_cum_freq[index - m_min_index + 1] - m_cum_freq[index - m_min_index];
+        }
+
+        range_t cum_freq(const int index) const override final
+        {
+            return m_cum_freq[index - m_min_index];
+        }
+
+        range_t total_freq() const
+        {
+            return m_cum_freq.back();
+        }
+
+        int min_index() const override final
         {
-            auto left = pmodel.min_index();
-            auto right = pmodel.max_index();
-            const auto range_per_total = range() / pmodel.total_freq();
-            const auto f = (m_data - lower_bound()) / range_per_total;
+            return m_min_index;
+        }
 
-            if constexpr (RANGECODER_VERBOSE)
+        int max_index() const override final
+        {
+            return m_min_index + static_cast<int>(m_cum_freq.size()) - 2;
+        }
+
+    private:
+        int m_min_index = 0;
+        std::vector<range_t> m_cum_freq = std::vector<range_t>(1, 0);
+    };
+
+    // Static frequency table normalized by normalize_freq, so coder divides by shift.
+    template<int TOTAL_FREQ_BITS_ = 16>
+    class PowerOfTwoFrequencyTable : public FrequencyTable
+    {
+    public:
+        static constexpr int TOTAL_FREQ_BITS = TOTAL_FREQ_BITS_;
+
+        // Throws std::invalid_argument if freq can not be normalized, see normalize_freq.
+        explicit PowerOfTwoFrequencyTable(const std::vector<range_t> &freq, const int min_index = 0)
+            : FrequencyTable(normalize_or_throw(freq), min_index)
+        {
+        }
+
+    private:
+        static auto normalize_or_throw(const std::vector<range_t> &freq) -> std::vector<range_t>
+        {
+            auto normalized = normalize_freq(freq, TOTAL_FREQ_BITS);
+            if (normalized.empty())
             {
-                std::cout << "  --------- BINARY SEARCH ---------" << std::endl;
-                std::cout << "  find cum: (data: 0x"
-                          << local::hex_zero_filled(m_data)
-                          << " - lower bound: 0x"
-                          << local::hex_zero_filled(lower_bound())
-                          << ")"
-                          << std::endl
-                          << "            / range_per_total: 0x"
-                          << local::hex_zero_filled(range_per_total)
-                          << " = "
-                          << f
-                          << std::endl;
-                std::cout << "  binary search encoded index: " << left << " " << right << std::endl;
+                throw std::invalid_argument("PowerOfTwoFrequencyTable: freq has no non zero frequency or more than 2^TOTAL_FREQ_BITS");
             }
+            return normalized;
+        }
+    };
 
-            while (left < right)
+    namespace local
+    {
+        inline void put_varint(std::vector<byte_t> &bytes, uint64_t value)
+        {
+            while (value >= 0x80)
             {
-                const auto mid = (left + right) / 2;
-                const auto mid_cum = pmodel.cum_freq(mid + 1);
+                bytes.push_back(static_cast<byte_t>(value | 0x80));
+                value >>= 7;
+            }
+            bytes.push_back(static_cast<byte_t>(value));
+        }
 
-                if constexpr (RANGECODER_VERBOSE)
+        // Read LEB128 varint at bytes[offset] and advance offset, missing bytes past size are read as 0.
+        inline auto get_varint(const byte_t *bytes, const size_t size, size_t &offset) -> uint64_t
+        {
+            auto value = uint64_t(0);
+            for (auto shift = 0; shift < 64; shift += 7)
+            {
+                const auto byte = offset < size ? bytes[offset] : byte_t(0);
+                offset++;
+                value |= uint64_t(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
                 {
-                    std::cout << "  middle index: (left: " << left << " + right: " << right << " ) / 2 = " << mid
-                              << ", cum at middle: " << mid_cum << std::endl;
+                    break;
                 }
+            }
+            return value;
+        }
+    }
 
-                if (mid_cum <= f)
+    // Append compact header of static model pmodel to bytes.
+    // Format is varint zigzag min_index, varint number of indices,
+    // then runs of (varint zeros, varint nonzeros, varint freq - 1 for each nonzero),
+    // so sparse alphabets cost a few bytes per run of used indices.
+    // When quantize_bits > 0 frequencies are normalized to total 2^quantize_bits first,
+    // unless normalize_freq can not, then they are written as is.
+    template<class PModelT>
+    void serialize_model(const PModelT &pmodel, std::vector<byte_t> &bytes, const int quantize_bits = 0)
+    {
+        const auto min_index = pmodel.min_index();
+        auto freq = std::vector<range_t>(static_cast<size_t>(pmodel.max_index() - min_index + 1));
+        for (size_t i = 0; i < freq.size(); i++)
+        {
+            freq[i] = pmodel.c_freq(min_index + static_cast<int>(i));
+        }
+        if (quantize_bits > 0)
+        {
+            auto quantized = normalize_freq(freq, quantize_bits);
+            if (!quantized.empty())
+            {
+                freq = std::move(quantized);
+            }
+        }
+
+        const auto zigzag = (static_cast<uint64_t>(min_index) << 1) ^ static_cast<uint64_t>(min_index < 0 ? -1 : 0);
+        local::put_varint(bytes, zigzag);
+        local::put_varint(bytes, freq.size());
+        size_t i = 0;
+        while (i < freq.size())
+        {
+            const auto run_begin = i;
+            while (i < freq.size() && freq[i] == 0)
+            {
+                i++;
+            }
+            const auto nonzero_begin = i;
+            while (i < freq.size() && freq[i] != 0)
+            {
+                i++;
+            }
+            local::put_varint(bytes, nonzero_begin - run_begin);
+            local::put_varint(bytes, i - nonzero_begin);
+            for (auto j = nonzero_begin; j < i; j++)
+            {
+                local::put_varint(bytes, freq[j] - 1);
+            }
+        }
+    }
+
+    // Read header written by serialize_model at bytes[offset] into pmodel and advance offset past it.
+    // Returns false, leaving pmodel and offset unchanged, if header is malformed or truncated,
+    // or has more than max_num_indices indices, which bounds the table a few bytes of zero runs could claim,
+    // or if its total_freq is 0 or above max_total_freq, which defaults to BOTTOM of default coder.
+    // Cumulative table is built while reading, wrap result in LookupTableModel for fast decode.
+    inline auto deserialize_model(const byte_t *bytes, const size_t size, size_t &offset, FrequencyTable &pmodel, const size_t max_num_indices = size_t(1) << 24,
+                                  const range_t max_total_freq = local::RangeCoder<>::BOTTOM) -> bool
+    {
+        auto cursor = offset;
+        const auto zigzag = local::get_varint(bytes, size, cursor);
+        const auto min_index = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+        const auto num_indices = local::get_varint(bytes, size, cursor);
+        if (cursor > size || min_index < std::numeric_limits<int>::min() || num_indices > max_num_indices ||
+            num_indices > static_cast<uint64_t>(std::numeric_limits<int>::max()) ||
+            min_index + static_cast<int64_t>(num_indices) - 1 > std::numeric_limits<int>::max())
+        {
+            return false;
+        }
+
+        auto cum_freq = std::vector<range_t>(static_cast<size_t>(num_indices) + 1, 0);
+        size_t i = 0;
+        while (i < num_indices)
+        {
+            const auto num_zeros = local::get_varint(bytes, size, cursor);
+            const auto num_nonzeros = local::get_varint(bytes, size, cursor);
+            // Writer never emits empty run nor run past num_indices.
+            if (cursor > size || (num_zeros == 0 && num_nonzeros == 0) || num_zeros > num_indices - i || num_nonzeros > num_indices - i - num_zeros)
+            {
+                return false;
+            }
+            for (const auto end = i + num_zeros; i < end; i++)
+            {
+                cum_freq[i + 1] = cum_freq[i];
+            }
+            for (const auto end = i + num_nonzeros; i < end; i++)
+            {
+                const auto freq = local::get_varint(bytes, size, cursor);
+                if (cursor > size || freq >= max_total_freq - cum_freq[i])
                 {
-                    if constexpr (RANGECODER_VERBOSE)
-                    {
-                        std::cout << "  target contains between left:" << left << " middle: " << mid << std::endl;
-                    }
-                    left = mid + 1;
+                    return false;
                 }
-                else
+                cum_freq[i + 1] = cum_freq[i] + freq + 1;
+            }
+        }
+        if (cum_freq.back() == 0)
+        {
+            return false;
+        }
+        pmodel = FrequencyTable::from_cum_freq(std::move(cum_freq), static_cast<int>(min_index));
+        offset = cursor;
+        return true;
+    }
+
+    inline auto deserialize_model(const std::vector<byte_t> &bytes, FrequencyTable &pmodel) -> bool
+    {
+        auto offset = size_t(0);
+        return deserialize_model(bytes.data(), bytes.size(), offset, pmodel);
+    }
+
+    // Count each index of data[0, n) in [min_index, max_index], indices outside are ignored.
+    // Each thread counts its own part into 4 interleaved sub-histograms, so repeated indices
+    // do not wait on store to load forwarding of the same counter.
+    // num_threads 0 uses hardware concurrency, small inputs are counted on calling thread.
+    inline auto histogram(const int *data, const size_t n, const int min_index, const int max_index, const unsigned num_threads = 1) -> std::vector<range_t>
+    {
+        const auto num_indices = static_cast<size_t>(max_index - min_index + 1);
+        // Parts are small enough for 32 bit counters and large enough to pay for a thread.
+        const auto max_part_size = size_t(1) << 30;
+        const auto min_part_size = size_t(1) << 18;
+        const auto threads = num_threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : num_threads;
+        const auto part_size = std::min(max_part_size, std::max(min_part_size, (n + threads - 1) / threads));
+        const auto num_parts = std::max(size_t(1), (n + part_size - 1) / part_size);
+
+        auto part_freq = std::vector<std::vector<range_t>>(num_parts);
+        parallel_for(num_parts, threads, [&](const size_t part) {
+            const auto first = data + part * part_size;
+            const auto last = data + std::min(n, (part + 1) * part_size);
+            // Slot num_indices of each sub-histogram collects indices out of range.
+            const auto stride = num_indices + 1;
+            auto counts = std::vector<uint32_t>(4 * stride, 0);
+            const auto slot = [&](const int d) {
+                const auto i = static_cast<size_t>(static_cast<unsigned>(d - min_index));
+                return i < num_indices ? i : num_indices;
+            };
+            auto it = first;
+            for (; last - it >= 4; it += 4)
+            {
+                counts[slot(it[0])]++;
+                counts[stride + slot(it[1])]++;
+                counts[2 * stride + slot(it[2])]++;
+                counts[3 * stride + slot(it[3])]++;
+            }
+            for (; it != last; it++)
+            {
+                counts[slot(*it)]++;
+            }
+            auto &freq = part_freq[part];
+            freq.resize(num_indices);
+            for (size_t i = 0; i < num_indices; i++)
+            {
+                freq[i] = range_t(counts[i]) + counts[stride + i] + counts[2 * stride + i] + counts[3 * stride + i];
+            }
+        });
+
+        auto freq = std::move(part_freq[0]);
+        for (size_t part = 1; part < num_parts; part++)
+        {
+            for (size_t i = 0; i < num_indices; i++)
+            {
+                freq[i] += part_freq[part][i];
+            }
+        }
+        return freq;
+    }
+
+    // Build FrequencyTable of data[0, n) for indices [min_index, max_index], see histogram.
+    // When total_freq_bits > 0 frequencies are normalized to total 2^total_freq_bits,
+    // unless normalize_freq can not, then counts are used as is.
+    inline auto build_frequency_table(const int *data, const size_t n, const int min_index, const int max_index, const int total_freq_bits = 0, const unsigned num_threads = 1) -> FrequencyTable
+    {
+        auto freq = histogram(data, n, min_index, max_index, num_threads);
+        if (total_freq_bits > 0)
+        {
+            auto normalized = normalize_freq(freq, total_freq_bits);
+            if (!normalized.empty())
+            {
+                freq = std::move(normalized);
+            }
+        }
+        // Prefix sum in place, shifted by one so freq becomes cumulative table.
+        auto sum = range_t(0);
+        for (auto &f : freq)
+        {
+            const auto c = f;
+            f = sum;
+            sum += c;
+        }
+        freq.push_back(sum);
+        return FrequencyTable::from_cum_freq(std::move(freq), min_index);
+    }
+
+    // Static model PModelT with precomputed table from frequency slot to index,
+    // so decoder finds index with one table read and short linear fixup instead of binary search.
+    // Table has 2^lookup_bits entries, each covering total_freq / 2^lookup_bits frequencies,
+    // so fixup is not needed when total_freq <= 2^lookup_bits.
+    // Throws std::invalid_argument if total_freq of pmodel is 0, as no index could be decoded.
+    template<class PModelT>
+    class LookupTableModel : public PModelT
+    {
+    public:
+        explicit LookupTableModel(PModelT pmodel, const int lookup_bits = 12) : PModelT(std::move(pmodel))
+        {
+            m_max_index = PModelT::max_index();
+            const auto total_freq = local::total_freq(static_cast<const PModelT &>(*this));
+            if (total_freq == 0)
+            {
+                throw std::invalid_argument("LookupTableModel: total_freq must not be 0");
+            }
+            auto total_bits = 0;
+            while (total_bits < 64 && (range_t(1) << total_bits) < total_freq)
+            {
+                total_bits++;
+            }
+            m_shift = std::max(0, total_bits - lookup_bits);
+            m_max_freq = total_freq - 1;
+
+            m_table.resize(((total_freq - 1) >> m_shift) + 1);
+            auto index = PModelT::min_index();
+            for (size_t slot = 0; slot < m_table.size(); slot++)
+            {
+                const auto f = range_t(slot) << m_shift;
+                while (index < m_max_index && PModelT::cum_freq(index + 1) <= f)
                 {
-                    if constexpr (RANGECODER_VERBOSE)
-                    {
-                        std::cout << "  target contains between middle:" << mid << " right: " << right << std::endl;
-                    }
-                    right = mid;
+                    index++;
                 }
+                m_table[slot] = index;
             }
-            if constexpr (RANGECODER_VERBOSE)
+        }
+
+        // f >= total_freq, only seen on corrupt input, is clamped so table read stays in bounds.
+        int find_index(const range_t f) const
+        {
+            auto index = m_table[std::min(f, m_max_freq) >> m_shift];
+            while (index < m_max_index && PModelT::cum_freq(index + 1) <= f)
             {
-                std::cout << "  find! left: " << left << "= right: " << right << std::endl;
-                std::cout << "  --------- BINARY SEARCH FINISH ---------" << std::endl;
+                index++;
             }
-            return left;
-        };
+            return index;
+        }
 
-        void shift_byte_buffer()
+    private:
+        int m_shift;
+        int m_max_index;
+        range_t m_max_freq;
+        std::vector<int> m_table;
+    };
+
+    // Adaptive frequency model for indices [0, num_symbols), backed by Fenwick tree.
+    // cum_freq, update and find_index are O(log N), so it suits large alphabets.
+    // Encoder calls update(index) after encode, decoder after decode.
+    class AdaptiveDistribution : public PModel
+    {
+    public:
+        // Every index starts with frequency 1, each update adds increment,
+        // and all frequencies are halved once total exceeds max_total_freq.
+        // max_total_freq is raised to 8 * num_symbols for large alphabets, so rescale, which is O(N),
+        // comes at most once per 3.5 * N / increment updates instead of on every update.
+        explicit AdaptiveDistribution(const int num_symbols, const range_t increment = 32, const range_t max_total_freq = range_t(1) << 16)
+            : m_increment(increment), m_max_total_freq(std::max(max_total_freq, range_t(8) * static_cast<range_t>(num_symbols))), m_freq(num_symbols, 1),
+              m_tree(num_symbols + 1, 0)
         {
-            const auto front_byte = m_bytes.front();
-            m_data = (m_data << 8) | static_cast<range_t>(front_byte);
-            m_bytes.pop();
-        };
+            m_top_step = 1;
+            while (m_top_step * 2 <= num_symbols)
+            {
+                m_top_step *= 2;
+            }
+            rebuild();
+        }
+
+        range_t c_freq(const int index) const override final
+        {
+            return m_freq[index];
+        }
+
+        range_t cum_freq(const int index) const override final
+        {
+            auto sum = range_t(0);
+            for (auto i = index; i > 0; i -= i & -i)
+            {
+                sum += m_tree[i];
+            }
+            return sum;
+        }
+
+        range_t total_freq() const
+        {
+            return m_total_freq;
+        }
+
+        int min_index() const override final
+        {
+            return 0;
+        }
+
+        int max_index() const override final
+        {
+            return static_cast<int>(m_freq.size()) - 1;
+        }
+
+        // Descend the tree to the index whose range contains f, or last index if f >= total_freq (corrupt input).
+        int find_index(range_t f) const
+        {
+            const auto size = static_cast<int>(m_freq.size());
+            auto index = 0;
+            for (auto step = m_top_step; step != 0; step >>= 1)
+            {
+                if (index + step <= size && m_tree[index + step] <= f)
+                {
+                    index += step;
+                    f -= m_tree[index];
+                }
+            }
+            return std::min(index, size - 1);
+        }
+
+        void update(const int index)
+        {
+            m_freq[index] += m_increment;
+            m_total_freq += m_increment;
+            for (auto i = index + 1; i < static_cast<int>(m_tree.size()); i += i & -i)
+            {
+                m_tree[i] += m_increment;
+            }
+            if (m_total_freq > m_max_total_freq)
+            {
+                rescale();
+            }
+        }
+
+    private:
+        // Halve all frequencies, keeping them non zero.
+        void rescale()
+        {
+            for (auto &freq : m_freq)
+            {
+                freq = (freq + 1) / 2;
+            }
+            rebuild();
+        }
+
+        // Build tree from m_freq in O(N).
+        void rebuild()
+        {
+            m_total_freq = 0;
+            for (size_t i = 0; i < m_freq.size(); i++)
+            {
+                m_tree[i + 1] = m_freq[i];
+                m_total_freq += m_freq[i];
+            }
+            for (size_t i = 1; i < m_tree.size(); i++)
+            {
+                const auto parent = i + (i & -i);
+                if (parent < m_tree.size())
+                {
+                    m_tree[parent] += m_tree[i];
+                }
+            }
+        }
+
+        range_t m_increment;
+        range_t m_max_total_freq;
+        range_t m_total_freq = 0;
+        int m_top_step;
+        std::vector<range_t> m_freq;
+        std::vector<range_t> m_tree;
+    };
+
+    // Adaptive order-N context model for indices [0, num_symbols).
+    // Frequency table is selected by previous order indices (hashed into 2^context_bits tables if they don't fit),
+    // and all tables live in one contiguous arena of 16 bit cumulative frequencies,
+    // so cum_freq and c_freq are O(1) and find_index is binary search within one small table.
+    // Encoder calls update(index) after encode, decoder after decode, which also moves to next context.
+    class ContextModel : public PModel
+    {
+    public:
+        static constexpr range_t MAX_TOTAL_FREQ = (range_t(1) << 16) - 1;
+        static constexpr int MAX_CONTEXT_BITS = 24;
+
+        // Throws std::invalid_argument unless num_symbols + 2 * increment <= MAX_TOTAL_FREQ,
+        // so a table still has room for increment after rescale and 16 bit frequencies never wrap,
+        // or unless order >= 0 and context_bits is in [0, MAX_CONTEXT_BITS]. context_bits 0 is a single order-0 table.
+        explicit ContextModel(const int num_symbols, const int order = 1, const int context_bits = 12, const range_t increment = 24)
+            : m_num_symbols(num_symbols), m_context_bits(context_bits), m_increment(increment)
+        {
+            if (num_symbols < 1 || increment > MAX_TOTAL_FREQ || static_cast<range_t>(num_symbols) + 2 * increment > MAX_TOTAL_FREQ)
+            {
+                throw std::invalid_argument("ContextModel: num_symbols + 2 * increment must not exceed MAX_TOTAL_FREQ");
+            }
+            if (order < 0 || context_bits < 0 || context_bits > MAX_CONTEXT_BITS)
+            {
+                throw std::invalid_argument("ContextModel: order must not be negative and context_bits must be in [0, MAX_CONTEXT_BITS]");
+            }
+            m_symbol_bits = 0;
+            while ((1 << m_symbol_bits) < num_symbols)
+            {
+                m_symbol_bits++;
+            }
+            // With one table history is never used, and hashing it would shift by 64.
+            const auto history_bits = context_bits == 0 ? 0 : std::min(64, order * m_symbol_bits);
+            m_history_mask = history_bits == 64 ? ~uint64_t(0) : (uint64_t(1) << history_bits) - 1;
+            m_hash_history = history_bits > context_bits;
+
+            const auto table_size = static_cast<size_t>(num_symbols) + 1;
+            m_arena.resize(table_size << context_bits);
+            for (size_t i = 0; i < m_arena.size(); i++)
+            {
+                m_arena[i] = static_cast<uint16_t>(i % table_size);
+            }
+        }
+
+        range_t c_freq(const int index) const override final
+        {
+            const auto table = current_table();
+            return table[index + 1] - table[index];
+        }
+
+        range_t cum_freq(const int index) const override final
+        {
+            return current_table()[index];
+        }
+
+        range_t total_freq() const
+        {
+            return current_table()[m_num_symbols];
+        }
+
+        int min_index() const override final
+        {
+            return 0;
+        }
+
+        int max_index() const override final
+        {
+            return m_num_symbols - 1;
+        }
+
+        int find_index(const range_t f) const
+        {
+            const auto table = current_table();
+            return static_cast<int>(std::upper_bound(table + 1, table + m_num_symbols, f) - table) - 1;
+        }
+
+        // Count index in current context, and move to context followed by index.
+        void update(const int index)
+        {
+            if (total_freq() + m_increment > MAX_TOTAL_FREQ)
+            {
+                rescale();
+            }
+            const auto table = m_arena.data() + m_table_offset;
+            for (auto i = index + 1; i <= m_num_symbols; i++)
+            {
+                table[i] = static_cast<uint16_t>(table[i] + m_increment);
+            }
+
+            m_history = ((m_history << m_symbol_bits) | static_cast<uint64_t>(index)) & m_history_mask;
+            const auto context = m_hash_history ? (m_history * 0x9e3779b97f4a7c15) >> (64 - m_context_bits) : m_history;
+            m_table_offset = context * (static_cast<size_t>(m_num_symbols) + 1);
+        }
+
+    private:
+        auto current_table() const -> const uint16_t *
+        {
+            return m_arena.data() + m_table_offset;
+        }
+
+        // Halve frequencies of current table, keeping them non zero.
+        void rescale()
+        {
+            const auto table = m_arena.data() + m_table_offset;
+            auto cum_freq = uint16_t(0);
+            for (auto i = 0; i < m_num_symbols; i++)
+            {
+                const auto freq = table[i + 1] - table[i];
+                table[i] = cum_freq;
+                cum_freq = static_cast<uint16_t>(cum_freq + (freq + 1) / 2);
+            }
+            table[m_num_symbols] = cum_freq;
+        }
 
-        std::queue<byte_t> m_bytes;
-        range_t m_data;
+        int m_num_symbols;
+        int m_context_bits;
+        int m_symbol_bits;
+        range_t m_increment;
+        uint64_t m_history = 0;
+        uint64_t m_history_mask;
+        bool m_hash_history;
+        std::vector<uint16_t> m_arena;
+        // Offset of current context's table in m_arena, so copies of model don't alias each other's arena.
+        size_t m_table_offset = 0;
     };
 
     template<int N = 256>
     class UniformDistribution : public PModel
     {
     public:
+        static constexpr int TOTAL_FREQ_BITS = local::log2_if_power_of_two(N);
+
         UniformDistribution() = default;
 
-        range_t c_freq(const int index) const override
+        range_t c_freq(const int index) const override final
         {
             return 1;
         }
 
-        range_t cum_freq(const int index) const override
+        range_t cum_freq(const int index) const override final
         {
             return index;
         }
 
-        int min_index() const override
+        range_t total_freq() const
+        {
+            return N;
+        }
+
+        int find_index(const range_t f) const
+        {
+            return static_cast<int>(std::min(f, range_t(N - 1)));
+        }
+
+        int min_index() const override final
         {
             return 0;
         }
 
-        int max_index() const override
+        int max_index() const override final
         {
             return N - 1;
         }
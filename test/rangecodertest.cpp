@@ -534,6 +534,1173 @@ TEST(RangeCoderDebug, ReproductionTest)
     std::cout << "------------------------------" << std::endl;
 }
 
+// Probability model not derived from rangecoder::PModel, used through the templated encode/decode.
+class StaticSkewedModel
+{
+public:
+    rangecoder::range_t c_freq(const int index) const
+    {
+        return index == 0 ? 13 : 1;
+    }
+    rangecoder::range_t cum_freq(const int index) const
+    {
+        return index == 0 ? 0 : 12 + index;
+    }
+    int min_index() const
+    {
+        return 0;
+    }
+    int max_index() const
+    {
+        return 3;
+    }
+};
+
+// test rangecoder with a model that is resolved at compile time.
+TEST(RangeCoderTest, StaticModelTest)
+{
+    const auto data = std::vector<int>{0, 0, 1, 0, 3, 0, 0, 2, 0, 0, 0, 1};
+    const auto pmodel = StaticSkewedModel();
+    auto enc = rangecoder::RangeEncoder();
+    for (const auto d : data)
+    {
+        enc.encode(pmodel, d);
+    }
+    const auto bytes = enc.finish();
+
+    auto dec = rangecoder::RangeDecoder();
+    dec.start(bytes);
+    auto decoded = std::vector<int>();
+    for (int i = 0; i < data.size(); i++)
+    {
+        decoded.push_back(dec.decode(pmodel));
+    }
+    EXPECT_EQ(decoded, data);
+}
+
+// test decoding from caller owned memory, e.g. payload placed after a header in a network buffer.
+TEST(RangeCoderTest, DecodeFromPointerTest)
+{
+    const auto data = std::vector<int>{1, 5, 3, 15, 2, 7, 9, 2, 1, 0, 3, 1};
+    const auto pmodel = rangecoder::UniformDistribution<16>();
+    auto enc = rangecoder::RangeEncoder();
+    for (const auto d : data)
+    {
+        enc.encode(pmodel, d);
+    }
+    const auto bytes = enc.finish();
+
+    auto buffer = std::vector<rangecoder::byte_t>{0xde, 0xad};
+    buffer.insert(buffer.end(), bytes.begin(), bytes.end());
+
+    auto dec = rangecoder::RangeDecoder();
+    dec.start(buffer.data() + 2, bytes.size());
+    auto decoded = std::vector<int>();
+    for (int i = 0; i < data.size(); i++)
+    {
+        decoded.push_back(dec.decode(pmodel));
+    }
+    EXPECT_EQ(decoded, data);
+}
+
+// test encoding into preallocated buffer, caller's vector and ring buffer give the same bytes.
+TEST(RangeCoderTest, ByteSinkTest)
+{
+    const auto data = std::vector<int>{1, 5, 3, 15, 2, 7, 9, 2, 1, 0, 3, 1};
+    const auto pmodel = rangecoder::UniformDistribution<16>();
+
+    auto enc = rangecoder::RangeEncoder();
+    for (const auto d : data)
+    {
+        enc.encode(pmodel, d);
+    }
+    const auto bytes = enc.finish();
+
+    auto buffer = std::vector<rangecoder::byte_t>(64);
+    auto buffer_enc = rangecoder::BasicRangeEncoder<rangecoder::BufferSink>(rangecoder::BufferSink(buffer.data(), buffer.size()));
+    for (const auto d : data)
+    {
+        buffer_enc.encode(pmodel, d);
+    }
+    const auto buffer_size = buffer_enc.finish();
+    EXPECT_FALSE(buffer_enc.sink().overflowed());
+    EXPECT_EQ(std::vector<rangecoder::byte_t>(buffer.begin(), buffer.begin() + buffer_size), bytes);
+
+    auto small_buffer = std::vector<rangecoder::byte_t>(4);
+    auto small_enc = rangecoder::BasicRangeEncoder<rangecoder::BufferSink>(rangecoder::BufferSink(small_buffer.data(), small_buffer.size()));
+    for (const auto d : data)
+    {
+        small_enc.encode(pmodel, d);
+    }
+    EXPECT_EQ(small_enc.finish(), bytes.size());
+    EXPECT_TRUE(small_enc.sink().overflowed());
+
+    auto appended = std::vector<rangecoder::byte_t>{0xff};
+    auto ref_enc = rangecoder::BasicRangeEncoder<rangecoder::VectorRefSink>(rangecoder::VectorRefSink(appended));
+    for (const auto d : data)
+    {
+        ref_enc.encode(pmodel, d);
+    }
+    EXPECT_EQ(ref_enc.finish(), bytes.size());
+    EXPECT_EQ(std::vector<rangecoder::byte_t>(appended.begin() + 1, appended.end()), bytes);
+
+    // finish() puts 8 bytes at once.
+    auto ring_enc = rangecoder::BasicRangeEncoder<rangecoder::RingSink<8>>();
+    auto drained = std::vector<rangecoder::byte_t>();
+    auto drain = [&]() {
+        rangecoder::byte_t out[3];
+        const auto n = ring_enc.sink().read(out, 3);
+        drained.insert(drained.end(), out, out + n);
+    };
+    for (const auto d : data)
+    {
+        ring_enc.encode(pmodel, d);
+        drain();
+    }
+    ring_enc.finish();
+    while (ring_enc.sink().available() != 0)
+    {
+        drain();
+    }
+    EXPECT_FALSE(ring_enc.sink().overflowed());
+    EXPECT_EQ(drained, bytes);
+}
+
+// test batch encode and decode over arrays, mixed with single symbol calls.
+TEST(RangeCoderTest, BatchTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> rand_index(0, 15);
+    auto data = std::vector<int>(1000);
+    for (auto &d : data)
+    {
+        d = rand_index(rng) % 9;
+    }
+    const auto pmodel = FreqTable(data, 15);
+    const auto uniform = rangecoder::UniformDistribution<16>();
+
+    auto enc = rangecoder::RangeEncoder();
+    enc.encode(uniform, 7);
+    enc.encode(pmodel, data.data(), data.data() + data.size());
+    enc.encode(uniform, 3);
+    const auto bytes = enc.finish();
+
+    auto dec = rangecoder::RangeDecoder();
+    dec.start(bytes);
+    EXPECT_EQ(dec.decode(uniform), 7);
+    auto decoded = std::vector<int>(data.size());
+    dec.decode_n(pmodel, decoded.data(), decoded.size());
+    EXPECT_EQ(dec.decode(uniform), 3);
+    EXPECT_EQ(decoded, data);
+}
+
+// test frequency table normalized to power of two total, coded with shift instead of division.
+TEST(RangeCoderTest, PowerOfTwoFrequencyTableTest)
+{
+    const auto freq = std::vector<rangecoder::range_t>{1000000, 0, 1, 3, 70000, 1, 0, 42};
+    const auto normalized = rangecoder::normalize_freq(freq, 12);
+    ASSERT_EQ(normalized.size(), freq.size());
+    rangecoder::range_t sum = 0;
+    for (size_t i = 0; i < freq.size(); i++)
+    {
+        EXPECT_EQ(normalized[i] == 0, freq[i] == 0);
+        sum += normalized[i];
+    }
+    EXPECT_EQ(sum, 1 << 12);
+    EXPECT_TRUE(rangecoder::normalize_freq(freq, 2).empty());
+
+    EXPECT_THROW(rangecoder::PowerOfTwoFrequencyTable<2>{freq}, std::invalid_argument);
+    EXPECT_THROW(rangecoder::PowerOfTwoFrequencyTable<12>{std::vector<rangecoder::range_t>(4, 0)}, std::invalid_argument);
+
+    static_assert(rangecoder::PowerOfTwoFrequencyTable<12>::TOTAL_FREQ_BITS == 12);
+    static_assert(rangecoder::UniformDistribution<256>::TOTAL_FREQ_BITS == 8);
+    static_assert(rangecoder::UniformDistribution<89>::TOTAL_FREQ_BITS < 0);
+
+    const auto pmodel = rangecoder::PowerOfTwoFrequencyTable<12>(freq, -3);
+    EXPECT_EQ(pmodel.min_index(), -3);
+    EXPECT_EQ(pmodel.max_index(), 4);
+    const auto data = std::vector<int>{-3, -3, 1, -3, 4, -1, 0, 1, 2, -3, -3, 4};
+    auto enc = rangecoder::RangeEncoder();
+    for (const auto d : data)
+    {
+        enc.encode(pmodel, d);
+    }
+    const auto bytes = enc.finish();
+
+    auto dec = rangecoder::RangeDecoder();
+    dec.start(bytes);
+    auto decoded = std::vector<int>(data.size());
+    dec.decode_n(pmodel, decoded.data(), decoded.size());
+    EXPECT_EQ(decoded, data);
+}
+
+// test adaptive model with large alphabet, including rescale.
+TEST(RangeCoderTest, AdaptiveDistributionTest)
+{
+    const auto num_symbols = 3000;
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::geometric_distribution<int> rand_index(0.1);
+    auto data = std::vector<int>(20000);
+    for (auto &d : data)
+    {
+        d = std::min(rand_index(rng), num_symbols - 1);
+    }
+
+    auto enc_model = rangecoder::AdaptiveDistribution(num_symbols);
+    auto enc = rangecoder::RangeEncoder();
+    for (const auto d : data)
+    {
+        enc.encode(enc_model, d);
+        enc_model.update(d);
+    }
+    const auto bytes = enc.finish();
+    EXPECT_LT(bytes.size(), data.size());
+
+    auto dec_model = rangecoder::AdaptiveDistribution(num_symbols);
+    auto dec = rangecoder::RangeDecoder();
+    dec.start(bytes);
+    auto decoded = std::vector<int>();
+    for (int i = 0; i < data.size(); i++)
+    {
+        const auto d = dec.decode(dec_model);
+        EXPECT_EQ(dec_model.find_index(dec_model.cum_freq(d)), d);
+        dec_model.update(d);
+        decoded.push_back(d);
+    }
+    EXPECT_EQ(decoded, data);
+    EXPECT_EQ(dec_model.find_index(dec_model.total_freq()), num_symbols - 1);
+
+    // alphabet larger than max_total_freq still rescales only now and then, keeping total above num_symbols.
+    auto large = rangecoder::AdaptiveDistribution(100000);
+    for (auto i = 0; i < 1000; i++)
+    {
+        large.update(i);
+    }
+    EXPECT_EQ(large.total_freq(), rangecoder::range_t(100000 + 1000 * 32));
+}
+
+// test adaptive binary decisions and bit tree coded bytes, interleaved with modeled symbols.
+TEST(RangeCoderTest, BitModelTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::bernoulli_distribution rand_bit(0.05);
+    std::geometric_distribution<int> rand_byte(0.2);
+    auto bits = std::vector<int>(10000);
+    auto symbols = std::vector<int>(bits.size());
+    for (size_t i = 0; i < bits.size(); i++)
+    {
+        bits[i] = rand_bit(rng) ? 1 : 0;
+        symbols[i] = std::min(rand_byte(rng), 255);
+    }
+    const auto uniform = rangecoder::UniformDistribution<16>();
+
+    auto enc_bit_model = rangecoder::BitModel();
+    auto enc_bit_tree = rangecoder::BitTreeModel<8>();
+    auto enc = rangecoder::RangeEncoder();
+    for (size_t i = 0; i < bits.size(); i++)
+    {
+        enc.encode_bit(enc_bit_model, bits[i]);
+        enc.encode_bit_tree(enc_bit_tree, symbols[i]);
+        enc.encode(uniform, i % 16);
+    }
+    const auto bytes = enc.finish();
+    // 0.29 bit for decision, about 3 bits for symbol, 4 bits for uniform.
+    EXPECT_LT(bytes.size(), bits.size());
+
+    auto dec_bit_model = rangecoder::BitModel();
+    auto dec_bit_tree = rangecoder::BitTreeModel<8>();
+    auto dec = rangecoder::RangeDecoder();
+    dec.start(bytes);
+    for (size_t i = 0; i < bits.size(); i++)
+    {
+        ASSERT_EQ(dec.decode_bit(dec_bit_model), bits[i]);
+        ASSERT_EQ(dec.decode_bit_tree(dec_bit_tree), symbols[i]);
+        ASSERT_EQ(dec.decode(uniform), i % 16);
+    }
+}
+
+// test decoding static models through slot to index lookup table.
+TEST(RangeCoderTest, LookupTableModelTest)
+{
+    const auto freq = std::vector<rangecoder::range_t>{1000000, 0, 1, 3, 70000, 1, 0, 42, 0, 0};
+    const auto table = rangecoder::FrequencyTable(freq, -3);
+    const auto normalized_table = rangecoder::PowerOfTwoFrequencyTable<12>(freq);
+    const auto pmodel = rangecoder::LookupTableModel<rangecoder::FrequencyTable>(table, 8);
+    const auto normalized = rangecoder::LookupTableModel<rangecoder::PowerOfTwoFrequencyTable<12>>(normalized_table);
+    for (rangecoder::range_t f = 0; f < pmodel.total_freq(); f += 37)
+    {
+        ASSERT_EQ(pmodel.find_index(f), rangecoder::local::find_index(table, f, -3, 6));
+    }
+    for (rangecoder::range_t f = 0; f < normalized.total_freq(); f++)
+    {
+        ASSERT_EQ(normalized.find_index(f), rangecoder::local::find_index(normalized_table, f, 0, 9));
+    }
+    // out of range slot from corrupt input stays in table.
+    EXPECT_EQ(pmodel.find_index(pmodel.total_freq() * 4), pmodel.max_index());
+    EXPECT_EQ(normalized.find_index(normalized.total_freq() * 4), normalized.max_index());
+
+    const auto data = std::vector<int>{-3, -3, 1, -3, 4, -1, 0, 1, 1, -3, -3, 4};
+    auto enc = rangecoder::RangeEncoder();
+    for (const auto d : data)
+    {
+        enc.encode(pmodel, d);
+        enc.encode(normalized, d + 3);
+    }
+    const auto bytes = enc.finish();
+
+    auto dec = rangecoder::RangeDecoder();
+    dec.start(bytes);
+    for (const auto d : data)
+    {
+        EXPECT_EQ(dec.decode(pmodel), d);
+        EXPECT_EQ(dec.decode(normalized), d + 3);
+    }
+
+    EXPECT_THROW(rangecoder::LookupTableModel<rangecoder::FrequencyTable>{rangecoder::FrequencyTable()}, std::invalid_argument);
+}
+
+// test interleaved coding with several states, with single and batch calls.
+template<int NUM_STATES>
+void test_interleaved()
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::geometric_distribution<int> rand_index(0.2);
+    auto data = std::vector<int>(1001);
+    for (auto &d : data)
+    {
+        d = std::min(rand_index(rng), 255);
+    }
+    const auto pmodel = FreqTable(data, 255);
+    const auto uniform = rangecoder::UniformDistribution<256>();
+
+    auto enc = rangecoder::InterleavedRangeEncoder<NUM_STATES>();
+    enc.encode(uniform, 42);
+    enc.encode(pmodel, data.data(), data.data() + data.size());
+    enc.encode(uniform, 7);
+    const auto bytes = enc.finish();
+
+    auto dec = rangecoder::InterleavedRangeDecoder<NUM_STATES>();
+    dec.start(bytes);
+    EXPECT_EQ(dec.decode(uniform), 42);
+    auto decoded = std::vector<int>(data.size());
+    dec.decode_n(pmodel, decoded.data(), decoded.size());
+    EXPECT_EQ(dec.decode(uniform), 7);
+    EXPECT_EQ(decoded, data);
+
+    // byte j of state s is byte j of plain stream of symbols s, s + NUM_STATES, ..., padded with 0.
+    auto all = std::vector<int>{42};
+    all.insert(all.end(), data.begin(), data.end());
+    all.push_back(7);
+    for (auto state = 0; state < NUM_STATES; state++)
+    {
+        auto plain = rangecoder::RangeEncoder();
+        for (size_t i = state; i < all.size(); i += NUM_STATES)
+        {
+            if (i == 0 || i == all.size() - 1)
+            {
+                plain.encode(uniform, all[i]);
+            }
+            else
+            {
+                plain.encode(pmodel, all[i]);
+            }
+        }
+        const auto stream = plain.finish();
+        for (size_t j = 0; j * NUM_STATES + state < bytes.size(); j++)
+        {
+            ASSERT_EQ(bytes[j * NUM_STATES + state], j < stream.size() ? stream[j] : 0) << "state " << state << " byte " << j;
+        }
+    }
+}
+
+TEST(RangeCoderTest, InterleavedTest)
+{
+    test_interleaved<1>();
+    test_interleaved<2>();
+    test_interleaved<4>();
+    test_interleaved<8>();
+}
+
+// test block parallel encoding and decoding, with last block partially filled.
+TEST(RangeCoderTest, ParallelTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::geometric_distribution<int> rand_index(0.2);
+    auto data = std::vector<int>(100003);
+    for (auto &d : data)
+    {
+        d = std::min(rand_index(rng), 255);
+    }
+    const auto pmodel = rangecoder::LookupTableModel<rangecoder::FrequencyTable>(
+        rangecoder::FrequencyTable(std::vector<rangecoder::range_t>(256, 1)));
+
+    const auto bytes = rangecoder::parallel_encode(pmodel, data.data(), data.size(), 4096, 4);
+    ASSERT_EQ(rangecoder::parallel_decoded_size(bytes.data(), bytes.size()), data.size());
+    auto decoded = std::vector<int>(data.size());
+    EXPECT_TRUE(rangecoder::parallel_decode(pmodel, bytes.data(), bytes.size(), decoded.data(), 3));
+    EXPECT_EQ(decoded, data);
+
+    EXPECT_THROW(rangecoder::parallel_encode(pmodel, data.data(), 0, 0), std::invalid_argument);
+    const auto empty = rangecoder::parallel_encode(pmodel, data.data(), 0, 4096);
+    EXPECT_EQ(rangecoder::parallel_decoded_size(empty.data(), empty.size()), size_t(0));
+    EXPECT_TRUE(rangecoder::parallel_decode(pmodel, empty.data(), empty.size(), decoded.data()));
+
+    // header claiming more blocks than bytes hold is rejected before anything is allocated.
+    auto corrupt = bytes;
+    std::fill(corrupt.begin(), corrupt.begin() + 8, rangecoder::byte_t(0xff));
+    std::fill(corrupt.begin() + 8, corrupt.begin() + 16, rangecoder::byte_t(0));
+    corrupt[15] = 1;
+    EXPECT_EQ(rangecoder::parallel_decoded_size(corrupt.data(), corrupt.size()), size_t(0));
+    EXPECT_FALSE(rangecoder::parallel_decode(pmodel, corrupt.data(), corrupt.size(), decoded.data()));
+
+    // block length running past end of bytes is rejected.
+    auto overrun = std::vector<rangecoder::byte_t>();
+    rangecoder::local::put_uint64(overrun, 1000);
+    rangecoder::local::put_uint64(overrun, 1000);
+    rangecoder::local::put_uint64(overrun, ~uint64_t(0));
+    EXPECT_EQ(rangecoder::parallel_decoded_size(overrun.data(), overrun.size()), size_t(1000));
+    EXPECT_FALSE(rangecoder::parallel_decode(pmodel, overrun.data(), overrun.size(), decoded.data()));
+
+    // Same stream as sequential encoding of each block.
+    auto enc = rangecoder::RangeEncoder();
+    enc.encode(pmodel, data.data(), data.data() + 4096);
+    const auto first_block = enc.finish();
+    const auto offset = 16 + 8 * ((data.size() + 4095) / 4096);
+    EXPECT_TRUE(std::equal(first_block.begin(), first_block.end(), bytes.begin() + offset));
+}
+
+// test encoding to ostream while encoding, through small buffer.
+TEST(RangeCoderIOTest, OStreamSinkTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> rand_index(0, 255);
+    auto data = std::vector<int>(10000);
+    for (auto &d : data)
+    {
+        d = rand_index(rng);
+    }
+    const auto pmodel = rangecoder::UniformDistribution<256>();
+
+    auto enc = rangecoder::RangeEncoder();
+    enc.encode(pmodel, data.data(), data.data() + data.size());
+    const auto bytes = enc.finish();
+
+    std::stringstream ss;
+    auto stream_enc = rangecoder::BasicRangeEncoder<rangecoder::OStreamSink>(rangecoder::OStreamSink(ss, 64));
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        stream_enc.encode(pmodel, data[i]);
+        // Bytes are written as soon as buffer fills up.
+        ASSERT_LT(stream_enc.sink().size() - static_cast<size_t>(ss.tellp()), 64);
+    }
+    EXPECT_EQ(stream_enc.finish(), bytes.size());
+    const auto written = ss.str();
+    EXPECT_TRUE(std::equal(bytes.begin(), bytes.end(), written.begin(), written.end(), [](auto a, auto b) { return a == static_cast<rangecoder::byte_t>(b); }));
+
+    // buffer_size 0 writes every byte as put.
+    std::stringstream unbuffered;
+    auto unbuffered_enc = rangecoder::BasicRangeEncoder<rangecoder::OStreamSink>(rangecoder::OStreamSink(unbuffered, 0));
+    unbuffered_enc.encode(pmodel, data.data(), data.data() + data.size());
+    EXPECT_EQ(unbuffered_enc.finish(), bytes.size());
+    EXPECT_EQ(unbuffered.str(), written);
+    EXPECT_FALSE(unbuffered_enc.sink().failed());
+
+    // bytes that could not be written are not counted.
+    std::stringstream bad;
+    bad.setstate(std::ios::badbit);
+    auto bad_enc = rangecoder::BasicRangeEncoder<rangecoder::OStreamSink>(rangecoder::OStreamSink(bad, 64));
+    bad_enc.encode(pmodel, data.data(), data.data() + data.size());
+    EXPECT_EQ(bad_enc.finish(), size_t(0));
+    EXPECT_TRUE(bad_enc.sink().failed());
+}
+
+// test decoding from istream read on demand through small buffer.
+TEST(RangeCoderIOTest, IStreamRefillTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> rand_index(0, 255);
+    auto data = std::vector<int>(10000);
+    for (auto &d : data)
+    {
+        d = rand_index(rng);
+    }
+    const auto pmodel = rangecoder::UniformDistribution<256>();
+
+    std::stringstream ss;
+    auto enc = rangecoder::BasicRangeEncoder<rangecoder::OStreamSink>(rangecoder::OStreamSink(ss));
+    enc.encode(pmodel, data.data(), data.data() + data.size());
+    enc.finish();
+
+    auto dec = rangecoder::RangeDecoder();
+    dec.start(ss, 16);
+    EXPECT_EQ(dec.decode(pmodel), data[0]);
+    // Only first buffer is read to decode first symbol.
+    EXPECT_EQ(ss.tellg(), 16);
+    auto decoded = std::vector<int>(data.size() - 1);
+    dec.decode_n(pmodel, decoded.data(), decoded.size() / 2);
+    for (auto i = decoded.size() / 2; i < decoded.size(); i++)
+    {
+        decoded[i] = dec.decode(pmodel);
+    }
+    EXPECT_TRUE(std::equal(decoded.begin(), decoded.end(), data.begin() + 1));
+
+    // buffer_size 0 reads every byte as needed.
+    ss.clear();
+    ss.seekg(0);
+    auto unbuffered = rangecoder::RangeDecoder();
+    unbuffered.start(ss, 0);
+    decoded.resize(data.size());
+    unbuffered.decode_n(pmodel, decoded.data(), decoded.size());
+    EXPECT_EQ(decoded, data);
+}
+
+// test carry propagating coder, with skewed model where carryless coder loses coding space.
+TEST(RangeCoderTest, CarryRangeCoderTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::geometric_distribution<int> rand_index(0.7);
+    auto data = std::vector<int>(100000);
+    for (auto &d : data)
+    {
+        d = std::min(rand_index(rng), 255);
+    }
+    const auto pmodel = FreqTable(data, 255);
+    const auto uniform = rangecoder::UniformDistribution<256>();
+
+    auto enc = rangecoder::CarryRangeEncoder();
+    enc.encode(uniform, 255);
+    enc.encode(pmodel, data.data(), data.data() + data.size());
+    enc.encode(uniform, 0);
+    const auto bytes = enc.finish();
+
+    auto dec = rangecoder::CarryRangeDecoder();
+    dec.start(bytes);
+    EXPECT_EQ(dec.decode(uniform), 255);
+    auto decoded = std::vector<int>(data.size());
+    dec.decode_n(pmodel, decoded.data(), decoded.size());
+    EXPECT_EQ(dec.decode(uniform), 0);
+    EXPECT_EQ(decoded, data);
+
+    auto carryless = rangecoder::RangeEncoder();
+    carryless.encode(pmodel, data.data(), data.data() + data.size());
+    EXPECT_LE(bytes.size(), carryless.finish().size());
+}
+
+// test statistics policy counts same events in encoder and decoder.
+TEST(RangeCoderTest, CodingStatisticsTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::geometric_distribution<int> rand_index(0.5);
+    auto data = std::vector<int>(10000);
+    for (auto &d : data)
+    {
+        d = std::min(rand_index(rng), 255);
+    }
+    const auto pmodel = FreqTable(data, 255);
+
+    auto enc = rangecoder::BasicRangeEncoder<rangecoder::VectorSink, rangecoder::CodingStatistics>();
+    enc.encode(pmodel, data.data(), data.data() + data.size());
+    const auto &stats = enc.statistics();
+    EXPECT_EQ(stats.num_symbols(), data.size());
+    EXPECT_GT(stats.num_range_reduction_expansions(), 0);
+    EXPECT_GT(stats.range_reduction_bits_lost(), 0);
+    uint64_t num_symbols = 0;
+    uint64_t num_bytes = 0;
+    for (auto i = 0; i <= rangecoder::CodingStatistics::MAX_RENORMALIZATION_BYTES; i++)
+    {
+        num_symbols += stats.renormalization_histogram(i);
+        num_bytes += i * stats.renormalization_histogram(i);
+    }
+    EXPECT_EQ(num_symbols, data.size());
+    EXPECT_EQ(num_bytes, stats.num_bytes());
+    const auto bytes = enc.finish();
+    EXPECT_EQ(stats.num_bytes() + 8, bytes.size());
+
+    auto dec = rangecoder::BasicRangeDecoder<rangecoder::CodingStatistics>();
+    dec.start(bytes);
+    auto decoded = std::vector<int>(data.size());
+    dec.decode_n(pmodel, decoded.data(), decoded.size());
+    EXPECT_EQ(decoded, data);
+    EXPECT_EQ(dec.statistics().num_no_carry_expansions(), stats.num_no_carry_expansions());
+    EXPECT_EQ(dec.statistics().num_range_reduction_expansions(), stats.num_range_reduction_expansions());
+
+    static_assert(sizeof(rangecoder::RangeEncoder) == sizeof(rangecoder::local::RangeCoder<>) + sizeof(rangecoder::VectorSink));
+}
+
+// test order 1 and hashed order 2 context models on data where previous symbol predicts next one.
+TEST(RangeCoderTest, ContextModelTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> rand_index(0, 255);
+    std::bernoulli_distribution rand_follow(0.9);
+    auto data = std::vector<int>(50000);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = i != 0 && rand_follow(rng) ? (data[i - 1] * 7 + 1) % 256 : rand_index(rng);
+    }
+
+    for (const auto order : {1, 2})
+    {
+        auto enc_model = rangecoder::ContextModel(256, order, order == 1 ? 8 : 12);
+        auto enc = rangecoder::RangeEncoder();
+        for (const auto d : data)
+        {
+            enc.encode(enc_model, d);
+            enc_model.update(d);
+        }
+        const auto bytes = enc.finish();
+        // Order 0 costs 8 bits per symbol, as every symbol is equally frequent.
+        // Order 1 costs about 0.47 bit for follow and 0.1 * 8 bits for random symbol, plus learning each context.
+        EXPECT_LT(bytes.size(), data.size() * 3 / 8);
+
+        auto dec_model = rangecoder::ContextModel(256, order, order == 1 ? 8 : 12);
+        auto dec = rangecoder::RangeDecoder();
+        dec.start(bytes);
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            const auto d = dec.decode(dec_model);
+            ASSERT_EQ(d, data[i]);
+            dec_model.update(d);
+        }
+    }
+
+    // copy owns its tables.
+    auto model = rangecoder::ContextModel(16, 1, 4);
+    auto copy = model;
+    copy.update(3);
+    EXPECT_EQ(model.total_freq(), rangecoder::range_t(16));
+    EXPECT_EQ(copy.total_freq(), rangecoder::range_t(16));
+    copy = model;
+    model.update(3);
+    model.update(3);
+    EXPECT_EQ(model.total_freq(), rangecoder::range_t(16 + 24));
+    EXPECT_EQ(copy.total_freq(), rangecoder::range_t(16));
+
+    EXPECT_THROW(rangecoder::ContextModel(65535), std::invalid_argument);
+    EXPECT_THROW(rangecoder::ContextModel(256, 1, 8, 40000), std::invalid_argument);
+
+    // context_bits 0 counts every index in one table.
+    auto single = rangecoder::ContextModel(256, 1, 0);
+    for (auto i = 0; i < 10; i++)
+    {
+        single.update(i);
+    }
+    EXPECT_EQ(single.total_freq(), rangecoder::range_t(256 + 10 * 24));
+    EXPECT_EQ(single.c_freq(3), rangecoder::range_t(1 + 24));
+    EXPECT_THROW(rangecoder::ContextModel(256, 1, -1), std::invalid_argument);
+    EXPECT_THROW(rangecoder::ContextModel(256, 1, rangecoder::ContextModel::MAX_CONTEXT_BITS + 1), std::invalid_argument);
+    EXPECT_THROW(rangecoder::ContextModel(256, -1), std::invalid_argument);
+}
+
+// test model header round trip, with sparse alphabet and quantized frequencies.
+TEST(RangeCoderTest, SerializeModelTest)
+{
+    auto freq = std::vector<rangecoder::range_t>(60000, 0);
+    freq[0] = 1;
+    freq[1] = 300;
+    freq[2] = 100000;
+    freq[30000] = 7;
+    freq[59999] = 129;
+    const auto table = rangecoder::FrequencyTable(freq, -5);
+
+    auto bytes = std::vector<rangecoder::byte_t>{0xab};
+    rangecoder::serialize_model(table, bytes);
+    EXPECT_LT(bytes.size(), 32);
+    auto offset = size_t(1);
+    auto restored = rangecoder::FrequencyTable();
+    ASSERT_TRUE(rangecoder::deserialize_model(bytes.data(), bytes.size(), offset, restored));
+    EXPECT_EQ(offset, bytes.size());
+    ASSERT_EQ(restored.min_index(), table.min_index());
+    ASSERT_EQ(restored.max_index(), table.max_index());
+    for (auto i = table.min_index(); i <= table.max_index(); i++)
+    {
+        ASSERT_EQ(restored.c_freq(i), table.c_freq(i));
+        ASSERT_EQ(restored.cum_freq(i), table.cum_freq(i));
+    }
+
+    auto quantized_bytes = std::vector<rangecoder::byte_t>();
+    rangecoder::serialize_model(table, quantized_bytes, 12);
+    auto quantized_table = rangecoder::FrequencyTable();
+    ASSERT_TRUE(rangecoder::deserialize_model(quantized_bytes, quantized_table));
+    const auto quantized = rangecoder::LookupTableModel<rangecoder::FrequencyTable>(quantized_table);
+    EXPECT_EQ(quantized.total_freq(), 1 << 12);
+
+    const auto data = std::vector<int>{-3, -3, -4, 29995, -5, -3, 59994, -3};
+    auto enc = rangecoder::RangeEncoder();
+    for (const auto d : data)
+    {
+        enc.encode(quantized, d);
+    }
+    const auto encoded = enc.finish();
+    auto dec = rangecoder::RangeDecoder();
+    dec.start(encoded);
+    for (const auto d : data)
+    {
+        EXPECT_EQ(dec.decode(quantized), d);
+    }
+
+    // truncated or malformed header is rejected, leaving offset and table as they were.
+    offset = 0;
+    auto rejected = rangecoder::FrequencyTable();
+    EXPECT_FALSE(rangecoder::deserialize_model(bytes.data() + 1, 6, offset, rejected));
+    EXPECT_EQ(offset, size_t(0));
+    EXPECT_EQ(rejected.total_freq(), rangecoder::range_t(0));
+    // zigzag 0, 2^64 - 1 indices.
+    const auto huge = std::vector<rangecoder::byte_t>{0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01, 0, 1, 0};
+    EXPECT_FALSE(rangecoder::deserialize_model(huge, rejected));
+    // 2^24 + 1 indices, all zero in one run of a few bytes.
+    const auto many = std::vector<rangecoder::byte_t>{0, 0x81, 0x80, 0x80, 0x08, 0x81, 0x80, 0x80, 0x08, 0};
+    EXPECT_FALSE(rangecoder::deserialize_model(many, rejected));
+    // run past number of indices.
+    const auto overrun = std::vector<rangecoder::byte_t>{0, 2, 1, 2, 0, 0};
+    EXPECT_FALSE(rangecoder::deserialize_model(overrun, rejected));
+    // one index of frequency 0, and of frequency 2^48 + 1 above BOTTOM of coder.
+    const auto empty = std::vector<rangecoder::byte_t>{0, 1, 1, 0};
+    EXPECT_FALSE(rangecoder::deserialize_model(empty, rejected));
+    const auto too_large = std::vector<rangecoder::byte_t>{0, 1, 0, 1, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x40};
+    EXPECT_FALSE(rangecoder::deserialize_model(too_large, rejected));
+    EXPECT_EQ(rejected.total_freq(), rangecoder::range_t(0));
+}
+
+// test histogram and model builder against scalar count, on one and several threads.
+TEST(RangeCoderTest, HistogramTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::geometric_distribution<int> rand_index(0.05);
+    auto data = std::vector<int>(1000003);
+    auto expected = std::vector<rangecoder::range_t>(100, 0);
+    for (auto &d : data)
+    {
+        d = rand_index(rng) - 10;
+        if (d < 90)
+        {
+            expected[d + 10]++;
+        }
+    }
+
+    EXPECT_EQ(rangecoder::histogram(data.data(), data.size(), -10, 89), expected);
+    EXPECT_EQ(rangecoder::histogram(data.data(), data.size(), -10, 89, 4), expected);
+    EXPECT_EQ(rangecoder::histogram(data.data(), 0, -10, 89), std::vector<rangecoder::range_t>(100, 0));
+
+    const auto table = rangecoder::build_frequency_table(data.data(), data.size(), -10, 89, 0, 0);
+    const auto reference = rangecoder::FrequencyTable(expected, -10);
+    for (auto i = -10; i < 90; i++)
+    {
+        ASSERT_EQ(table.cum_freq(i), reference.cum_freq(i));
+        ASSERT_EQ(table.c_freq(i), reference.c_freq(i));
+    }
+    const auto normalized = rangecoder::build_frequency_table(data.data(), data.size(), -10, 89, 16, 2);
+    EXPECT_EQ(normalized.total_freq(), 1 << 16);
+}
+
+// test framed container, random block access, checksum and malformed frames.
+TEST(RangeCoderTest, FrameTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::geometric_distribution<int> rand_index(0.1);
+    auto data = std::vector<int>(10000);
+    for (auto &d : data)
+    {
+        d = std::min(rand_index(rng), 63);
+    }
+    const auto pmodel = rangecoder::FrequencyTable(std::vector<rangecoder::range_t>(64, 1));
+    auto bytes = rangecoder::frame_encode(pmodel, data.data(), data.size(), 999, true, 2);
+
+    auto reader = rangecoder::FrameReader();
+    ASSERT_TRUE(reader.open(bytes));
+    EXPECT_EQ(reader.num_blocks(), 11);
+    EXPECT_EQ(reader.num_symbols(), data.size());
+    EXPECT_EQ(reader.find_block(0), 0);
+    EXPECT_EQ(reader.find_block(5000), 5);
+    EXPECT_EQ(reader.find_block(data.size()), reader.num_blocks());
+
+    // decode only block holding symbol 7777, and last partial block.
+    for (const auto symbol : {size_t(7777), data.size() - 1})
+    {
+        const auto block = reader.find_block(symbol);
+        auto out = std::vector<int>(reader.block_num_symbols(block));
+        ASSERT_TRUE(reader.decode_block(pmodel, block, out.data()));
+        const auto first = data.begin() + static_cast<std::ptrdiff_t>(reader.block_first_symbol(block));
+        EXPECT_TRUE(std::equal(out.begin(), out.end(), first));
+    }
+
+    // blocks added one at a time, without checksum.
+    auto writer = rangecoder::FrameWriter(false);
+    writer.encode_block(pmodel, data.data(), data.data() + 10);
+    writer.encode_block(pmodel, data.data() + 10, data.data() + 10);
+    writer.encode_block(pmodel, data.data() + 10, data.data() + 25);
+    const auto small = writer.finish();
+    ASSERT_TRUE(reader.open(small));
+    EXPECT_EQ(reader.num_blocks(), 3);
+    EXPECT_EQ(reader.find_block(10), 2);
+    auto out = std::vector<int>(15);
+    ASSERT_TRUE(reader.decode_block(pmodel, 2, out.data()));
+    EXPECT_TRUE(std::equal(out.begin(), out.end(), data.begin() + 10));
+
+    // corrupted stream fails checksum, truncated frame fails to open.
+    ASSERT_TRUE(reader.open(bytes));
+    bytes[100] ^= 1;
+    EXPECT_FALSE(reader.verify_block(0));
+    EXPECT_TRUE(reader.verify_block(1));
+    EXPECT_FALSE(reader.decode_block(pmodel, 0, out.data()));
+    EXPECT_FALSE(reader.open(bytes.data(), bytes.size() - 1));
+    EXPECT_EQ(reader.num_blocks(), 0);
+    bytes[100] ^= 1;
+
+    // corrupted symbol count of last block fails its checksum, corrupted index fails to open.
+    ASSERT_TRUE(reader.open(bytes));
+    const auto last_header = rangecoder::local::get_uint64(bytes.data(), bytes.size(), bytes.size() - 16 - 16);
+    bytes[last_header + 2] ^= 4;
+    ASSERT_TRUE(reader.open(bytes));
+    EXPECT_GT(reader.num_symbols(), size_t(1) << 40);
+    EXPECT_FALSE(reader.verify_block(reader.num_blocks() - 1));
+    EXPECT_TRUE(reader.verify_block(0));
+    bytes[last_header + 2] ^= 4;
+    bytes[bytes.size() - 16 - 16 + 7] ^= 1;
+    EXPECT_FALSE(reader.open(bytes));
+}
+
+// test decoding from checkpoints in middle of stream.
+TEST(RangeCoderTest, CheckpointTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::geometric_distribution<int> rand_index(0.05);
+    auto data = std::vector<int>(10000);
+    for (auto &d : data)
+    {
+        d = std::min(rand_index(rng), 99);
+    }
+    auto freq = std::vector<rangecoder::range_t>(100);
+    for (const auto d : data)
+    {
+        freq[d]++;
+    }
+    const auto pmodel = rangecoder::FrequencyTable(freq);
+
+    const auto interval = size_t(300);
+    auto checkpoints = std::vector<rangecoder::Checkpoint>();
+    auto enc = rangecoder::RangeEncoder();
+    enc.encode(pmodel, data.data(), data.data() + data.size(), interval, checkpoints);
+    const auto bytes = enc.finish();
+    ASSERT_EQ(checkpoints.size(), (data.size() + interval - 1) / interval);
+
+    // checkpoints cost nothing, stream is same as without them.
+    auto plain = rangecoder::RangeEncoder();
+    plain.encode(pmodel, data.data(), data.data() + data.size());
+    EXPECT_EQ(plain.finish(), bytes);
+
+    for (size_t k = 0; k < checkpoints.size(); k++)
+    {
+        auto dec = rangecoder::RangeDecoder();
+        dec.start(bytes.data(), bytes.size(), checkpoints[k]);
+        const auto first = k * interval;
+        for (auto i = first; i < std::min(data.size(), first + interval + 5); i++)
+        {
+            ASSERT_EQ(dec.decode(pmodel), data[i]) << "checkpoint " << k << " symbol " << i;
+        }
+    }
+}
+
+// test raw bits of every width, interleaved with modeled symbols.
+TEST(RangeCoderTest, RawBitsTest)
+{
+    const auto seed = 12345;
+    std::mt19937_64 rng(seed);
+    const auto pmodel = FreqTable(std::vector<int>{0, 1, 1, 2, 2, 2, 3, 3, 3, 3}, 3);
+    auto values = std::vector<uint64_t>();
+    auto enc = rangecoder::RangeEncoder();
+    for (auto num_bits = 0; num_bits <= 64; num_bits++)
+    {
+        const auto value = num_bits == 64 ? rng() : rng() & ((uint64_t(1) << num_bits) - 1);
+        values.push_back(value);
+        enc.encode_bits(value, num_bits);
+        enc.encode(pmodel, num_bits % 4);
+    }
+    enc.encode_bits(~uint64_t(0), 64);
+    const auto bytes = enc.finish();
+    // raw bits, 65 symbols of about 2 bits, and 8 bytes of flush, with little lost to range reduction.
+    EXPECT_LE(bytes.size(), (64 * 65 / 2 + 64 + 65 * 2) / 8 + 8 + 8);
+
+    auto dec = rangecoder::RangeDecoder();
+    dec.start(bytes);
+    for (auto num_bits = 0; num_bits <= 64; num_bits++)
+    {
+        ASSERT_EQ(dec.decode_bits(num_bits), values[num_bits]) << num_bits << " bits";
+        ASSERT_EQ(dec.decode(pmodel), num_bits % 4);
+    }
+    EXPECT_EQ(dec.decode_bits(64), ~uint64_t(0));
+}
+
+// test round trip of coder with given state width and unit width, with every kind of symbol.
+template<class State, int UNIT_BITS>
+void test_state_and_unit()
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::geometric_distribution<int> rand_index(0.1);
+    auto data = std::vector<int>(5000);
+    auto freq = std::vector<rangecoder::range_t>(64, 0);
+    for (auto &d : data)
+    {
+        d = std::min(rand_index(rng), 63);
+        freq[d]++;
+    }
+    // total is below 2^16, which is limit of 32 bit state.
+    const auto table = rangecoder::FrequencyTable(freq);
+    const auto normalized = rangecoder::PowerOfTwoFrequencyTable<12>(freq);
+
+    auto enc = rangecoder::BasicRangeEncoder<rangecoder::VectorSink, rangecoder::NoStatistics, State, UNIT_BITS>();
+    auto bit_tree = rangecoder::BitTreeModel<6>();
+    enc.encode(table, data.data(), data.data() + data.size());
+    for (const auto d : data)
+    {
+        enc.encode(normalized, d);
+        enc.encode_bit_tree(bit_tree, d);
+        enc.encode_bits(static_cast<uint64_t>(d) * 0x123456789ull, 40);
+    }
+    const auto bytes = enc.finish();
+    EXPECT_EQ(bytes.size() % (UNIT_BITS / 8), 0);
+
+    auto dec = rangecoder::BasicRangeDecoder<rangecoder::NoStatistics, State, UNIT_BITS>();
+    dec.start(bytes);
+    auto decoded = std::vector<int>(data.size());
+    dec.decode_n(table, decoded.data(), decoded.size());
+    EXPECT_EQ(decoded, data);
+    bit_tree = rangecoder::BitTreeModel<6>();
+    for (const auto d : data)
+    {
+        ASSERT_EQ(dec.decode(normalized), d);
+        ASSERT_EQ(dec.decode_bit_tree(bit_tree), d);
+        ASSERT_EQ(dec.decode_bits(40), static_cast<uint64_t>(d) * 0x123456789ull);
+    }
+}
+
+TEST(RangeCoderTest, StateAndUnitTest)
+{
+    test_state_and_unit<uint32_t, 8>();
+    test_state_and_unit<uint64_t, 8>();
+    test_state_and_unit<uint64_t, 16>();
+    test_state_and_unit<unsigned __int128, 8>();
+    test_state_and_unit<unsigned __int128, 16>();
+    test_state_and_unit<unsigned __int128, 32>();
+
+    // default configuration is stream of RangeEncoder.
+    const auto pmodel = rangecoder::UniformDistribution<256>();
+    auto enc = rangecoder::RangeEncoder();
+    auto explicit_enc = rangecoder::BasicRangeEncoder<rangecoder::VectorSink, rangecoder::NoStatistics, uint64_t, 8>();
+    for (auto i = 0; i < 256; i++)
+    {
+        enc.encode(pmodel, i);
+        explicit_enc.encode(pmodel, i);
+    }
+    EXPECT_EQ(enc.finish(), explicit_enc.finish());
+}
+
+// test branchless renormalization gives same stream as renormalizing unit by unit.
+template<class State, int UNIT_BITS>
+void test_renormalization()
+{
+    const auto seed = 12345;
+    std::mt19937_64 rng(seed);
+    std::geometric_distribution<int> rand_index(0.3);
+    const auto pmodel = rangecoder::FrequencyTable(std::vector<rangecoder::range_t>{60000, 1, 1, 2, 3, 5, 8, 13, 21, 34});
+    auto bit_model = rangecoder::BitModel();
+    auto branchless_bit_model = rangecoder::BitModel();
+    auto enc = rangecoder::BasicRangeEncoder<rangecoder::VectorSink, rangecoder::NoStatistics, State, UNIT_BITS>();
+    auto branchless_enc = rangecoder::BasicRangeEncoder<rangecoder::VectorSink, rangecoder::NoStatistics, State, UNIT_BITS, true>();
+    for (auto i = 0; i < 20000; i++)
+    {
+        const auto index = std::min(rand_index(rng), 9);
+        const auto bit = static_cast<int>(rng() % 7 == 0);
+        const auto num_bits = static_cast<int>(rng() % 41);
+        const auto bits = rng() & ((uint64_t(1) << num_bits) - 1);
+        enc.encode(pmodel, index);
+        branchless_enc.encode(pmodel, index);
+        enc.encode_bit(bit_model, bit);
+        branchless_enc.encode_bit(branchless_bit_model, bit);
+        enc.encode_bits(bits, num_bits);
+        branchless_enc.encode_bits(bits, num_bits);
+    }
+    const auto bytes = enc.finish();
+    EXPECT_EQ(bytes, branchless_enc.finish());
+
+    auto dec = rangecoder::BasicRangeDecoder<rangecoder::NoStatistics, State, UNIT_BITS>();
+    auto branchless_dec = rangecoder::BasicRangeDecoder<rangecoder::NoStatistics, State, UNIT_BITS, true>();
+    dec.start(bytes);
+    branchless_dec.start(bytes);
+    auto decoded = std::vector<int>(5000);
+    auto branchless_decoded = std::vector<int>(5000);
+    dec.decode_n(pmodel, decoded.data(), decoded.size());
+    branchless_dec.decode_n(pmodel, branchless_decoded.data(), branchless_decoded.size());
+    EXPECT_EQ(decoded, branchless_decoded);
+}
+
+// test renormalization of both ways from crafted states, where range reduction shifts several units.
+template<class State, int UNIT_BITS>
+void test_renormalization_states()
+{
+    const auto seed = 12345;
+    std::mt19937_64 rng(seed);
+    const auto state_bits = static_cast<int>(sizeof(State)) * 8;
+    for (auto i = 0; i < 100000; i++)
+    {
+        // lower bound with runs of 0x00 and 0xff bytes, range of random length, upper bound at most 2^state_bits.
+        auto lower_bound = State(rng());
+        for (auto byte = 0; byte < state_bits / 8; byte++)
+        {
+            const auto r = rng() % 4;
+            const auto mask = State(0xff) << (8 * byte);
+            lower_bound = r == 0 ? lower_bound | mask : r == 1 ? lower_bound & ~mask : lower_bound;
+        }
+        const auto range_bits = 1 + static_cast<int>(rng() % state_bits);
+        auto range = std::max(State(1), State(rng()) >> (state_bits - range_bits));
+        range = std::min<State>(range, State(0) - lower_bound);
+        if (range == 0)
+        {
+            continue;
+        }
+
+        // fresh coder has lower bound 0, so unit range_per_total sets lower bound and range as given.
+        auto coder = rangecoder::local::RangeCoder<rangecoder::NoStatistics, State, UNIT_BITS>();
+        auto branchless_coder = rangecoder::local::RangeCoder<rangecoder::NoStatistics, State, UNIT_BITS, true>();
+        auto bits = State(0), branchless_bits = State(0);
+        auto num_units = 0, branchless_num_units = 0;
+        coder.template update_param<rangecoder::SILENT>(1, range, lower_bound, [&](auto b, auto n) {
+            bits = num_units == 0 ? b : bits;
+            num_units += n;
+        });
+        branchless_coder.template update_param<rangecoder::SILENT>(1, range, lower_bound, [&](auto b, auto n) {
+            branchless_bits = b;
+            branchless_num_units = n;
+        });
+        ASSERT_EQ(num_units, branchless_num_units) << std::hex << lower_bound << " " << range;
+        if (num_units != 0)
+        {
+            ASSERT_EQ(bits, branchless_bits);
+        }
+        ASSERT_EQ(coder.lower_bound(), branchless_coder.lower_bound()) << std::hex << lower_bound << " " << range;
+        ASSERT_EQ(coder.range(), branchless_coder.range()) << std::hex << lower_bound << " " << range;
+    }
+}
+
+TEST(RangeCoderTest, RenormalizationTest)
+{
+    test_renormalization_states<uint32_t, 8>();
+    test_renormalization_states<uint64_t, 8>();
+    test_renormalization_states<uint64_t, 16>();
+
+    test_renormalization<uint32_t, 8>();
+    test_renormalization<uint64_t, 8>();
+    test_renormalization<uint64_t, 16>();
+    test_renormalization<unsigned __int128, 8>();
+    test_renormalization<unsigned __int128, 32>();
+
+    // word stores of BufferSink, by branchless encoder, stay inside buffer and give same bytes.
+    const auto pmodel = rangecoder::UniformDistribution<65536>();
+    auto enc = rangecoder::RangeEncoder();
+    auto buffer = std::vector<rangecoder::byte_t>(300, 0xee);
+    auto buffer_enc = rangecoder::BasicRangeEncoder<rangecoder::BufferSink, rangecoder::NoStatistics, uint64_t, 8, true>(rangecoder::BufferSink(buffer.data(), 290));
+    for (auto i = 0; i < 141; i++)
+    {
+        enc.encode(pmodel, i * 463);
+        buffer_enc.encode(pmodel, i * 463);
+    }
+    const auto bytes = enc.finish();
+    ASSERT_EQ(buffer_enc.finish(), bytes.size());
+    EXPECT_TRUE(std::equal(bytes.begin(), bytes.end(), buffer.begin()));
+    EXPECT_EQ(buffer[290], 0xee);
+}
+
+// test coders reused with reset() give same streams as new ones, and pooled buffers keep capacity.
+TEST(RangeCoderTest, ResetTest)
+{
+    const auto seed = 12345;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> rand_index(0, 15);
+    auto messages = std::vector<std::vector<int>>(3);
+    for (auto &message : messages)
+    {
+        message.resize(1000 + rng() % 1000);
+        for (auto &d : message)
+        {
+            d = rand_index(rng);
+        }
+    }
+    const auto pmodel = rangecoder::UniformDistribution<16>();
+    auto expected = std::vector<std::vector<rangecoder::byte_t>>();
+    for (const auto &message : messages)
+    {
+        auto enc = rangecoder::RangeEncoder();
+        enc.encode(pmodel, message.data(), message.data() + message.size());
+        expected.push_back(enc.finish());
+    }
+
+    // buffer from pool is empty and keeps capacity.
+    auto released = std::vector<rangecoder::byte_t>(4096, 1);
+    const auto released_data = released.data();
+    rangecoder::release_buffer(std::move(released));
+    auto acquired = rangecoder::acquire_buffer();
+    EXPECT_TRUE(acquired.empty());
+    EXPECT_GE(acquired.capacity(), size_t(4096));
+    EXPECT_EQ(acquired.data(), released_data);
+    EXPECT_EQ(rangecoder::acquire_buffer().capacity(), size_t(0));
+    rangecoder::release_buffer(std::move(acquired));
+
+    auto enc = rangecoder::RangeEncoder();
+    auto buffer = std::vector<rangecoder::byte_t>(8192);
+    auto buffer_enc = rangecoder::BasicRangeEncoder<rangecoder::BufferSink>(rangecoder::BufferSink(buffer.data(), buffer.size()));
+    auto carry_enc = rangecoder::CarryRangeEncoder();
+    auto dec = rangecoder::RangeDecoder();
+    auto carry_dec = rangecoder::CarryRangeDecoder();
+    for (size_t m = 0; m < messages.size(); m++)
+    {
+        const auto &message = messages[m];
+        enc.reset(rangecoder::VectorSink(rangecoder::acquire_buffer()));
+        enc.encode(pmodel, message.data(), message.data() + message.size());
+        auto bytes = enc.finish();
+        EXPECT_EQ(bytes, expected[m]) << "message " << m;
+
+        buffer_enc.reset();
+        buffer_enc.encode(pmodel, message.data(), message.data() + message.size());
+        const auto size = buffer_enc.finish();
+        EXPECT_EQ(std::vector<rangecoder::byte_t>(buffer.begin(), buffer.begin() + size), expected[m]) << "message " << m;
+
+        carry_enc.reset(rangecoder::VectorSink(rangecoder::acquire_buffer()));
+        carry_enc.encode(pmodel, message.data(), message.data() + message.size());
+        auto carry_bytes = carry_enc.finish();
+        carry_dec.start(carry_bytes);
+        for (const auto d : message)
+        {
+            ASSERT_EQ(carry_dec.decode(pmodel), d) << "message " << m;
+        }
+        rangecoder::release_buffer(std::move(carry_bytes));
+
+        // reset drops stream left half decoded by previous message.
+        dec.reset();
+        dec.start(bytes);
+        for (const auto d : message)
+        {
+            ASSERT_EQ(dec.decode(pmodel), d) << "message " << m;
+        }
+        dec.start(expected[(m + 1) % messages.size()]);
+        dec.decode(pmodel);
+        rangecoder::release_buffer(std::move(bytes));
+    }
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);